@@ -7,6 +7,7 @@
 
 #include <iterator>
 #include <sstream>
+#include <algorithm>
 #include "MBUtils.h"
 #include "ACTable.h"
 #include "NavEKF.h"
@@ -22,19 +23,49 @@ nav_state(nullptr),
 sensor_estimation_matrix(rc_matrix_empty()),
 sensor_inputs(rc_vector_empty()),
 kf(rc_kalman_empty()),
+p_matrix_format(format_text),
+axis_output(true),
+axis_interval(0),
+engine(engine_rc),
+fusion_mode(fusion_tick),
+sequential_update(false),
+update_auto(true),
+factorized_covariance(false),
+adaptive_window(0),
+adaptive_min_scale(1),
+adaptive_max_scale(100),
+innovation_gate(0),
+gate_limit(10),
+rejected_published(0),
+autodiff_jacobian(false),
+state_dim(state_count),
+fixed_kf(nullptr),
+bank(nullptr),
+bank_threads(0),
+model_name("CTRA"),
+proc_noise(1),
+meas_noise(1),
+sensor_timeout(0),
+filter_rate(0),
+last_fusion_time(0),
+last_axis_publish(0),
+sample_y(rc_vector_empty()),
+wrapped_y(rc_vector_empty()),
+active_count(0),
+active_subset(nullptr),
+samples_dropped(0),
+samples_replayed(0),
+samples_stale(0),
+update_failures(0),
+worker_running(false),
+worker_inputs(rc_vector_empty()),
 data_received(0),
 data_good(false),
 server_connected(false),
-debug_enabled(false)
+debug_enabled(false),
+offline(false),
+debug_obsv(rc_matrix_empty())
 {
-    output_vars.resize(NavState2D::getStateCount(), "");
-    // Give the output variables default names
-    output_vars[state_axis_t::x] = "EKF_X";
-    output_vars[state_axis_t::y] = "EKF_Y";
-    output_vars[state_axis_t::theta] = "EKF_THETA";
-    output_vars[state_axis_t::v] = "EKF_V";
-    output_vars[state_axis_t::theta_dot] = "EKF_THETA_DOT";
-    output_vars[state_axis_t::v_dot] = "EKF_V_DOT";
 }
 
 //---------------------------------------------------------
@@ -42,11 +73,24 @@ debug_enabled(false)
 
 NavEKF::~NavEKF()
 {
+    // The worker has to stop before anything it uses is freed
+    if (worker.joinable())
+    {
+        worker_running = false;
+        worker.join();
+    }
     // Free allocated stuff (kalman filter freed on OnDisconnectFromServer)
     rc_vector_free(&sensor_inputs);
+    rc_vector_free(&worker_inputs);
+    rc_vector_free(&sample_y);
+    rc_vector_free(&wrapped_y);
     rc_matrix_free(&sensor_estimation_matrix);
+    rc_matrix_free(&debug_obsv);
     rc_kalman_free(&kf);
     if (nav_state) delete nav_state;
+    if (fixed_kf) delete fixed_kf;
+    if (bank) delete bank;
+    if (active_subset) delete active_subset;
 }
 
 //---------------------------------------------------------
@@ -59,25 +103,37 @@ bool NavEKF::OnNewMail(MOOSMSG_LIST &NewMail)
     for(p=NewMail.begin(); p!=NewMail.end(); p++)
     {
         CMOOSMsg &msg       = *p;
-        string key          = toupper(msg.GetKey());
-        bool not_handled    = true;
-        for (int i = 0; i < input_vars.size(); i++)
-        {
-            // search our inputs for the supplied message name and slot
-            // the received value into the appropriate element of the
-            // sensor input vector.
-            if ((key == input_vars[i]) && msg.IsDouble())
+        // m_sKey rather than GetKey(), which returns a copy
+        auto slots          = findInputSlots(msg.m_sKey);
+        if (slots && msg.IsDouble())
+        {
+            // slot the received value into every element of the sensor
+            // input vector that this variable feeds.
+            if (isfinite(msg.GetDouble()))
             {
-                if (isfinite(msg.GetDouble()))
+                for (int i : *slots)
                 {
                     sensor_inputs.d[i] = msg.GetDouble();
+                    // The worker and event fusion time their samples as
+                    // they take them from the rings
+                    if ((fusion_mode == fusion_tick) && (filter_rate == 0)) input_times[i] = msg.GetTime();
                     data_received += 1;
+                    // The worker thread takes its inputs from the rings
+                    // whatever the fusion mode
+                    if (((fusion_mode == fusion_event) || (filter_rate > 0)) &&
+                        !sample_rings[i].push({msg.GetTime(), msg.GetDouble(), i}))
+                    {
+                        samples_dropped++;
+                    }
                 }
-                not_handled = false;
             }
         }
-        if (not_handled && (key != "APPCAST_REQ")) // handled by AppCastingMOOSApp
-            reportRunWarning("Unhandled Mail: " + key);
+        else if (!slots)
+        {
+            string key = toupper(msg.GetKey());
+            if (key != "APPCAST_REQ") // handled by AppCastingMOOSApp
+                reportRunWarning("Unhandled Mail: " + key);
+        }
         if (!data_good && (data_received > input_vars.size()))
         {
             data_good = true;
@@ -87,10 +143,32 @@ bool NavEKF::OnNewMail(MOOSMSG_LIST &NewMail)
             }
         }
     }
+    // In event mode the outputs follow the mail rather than AppTick
+    if ((fusion_mode == fusion_event) && (filter_rate == 0) && nav_state &&
+        (drainSamples() > 0))
+    {
+        publishState();
+    }
 
     return(true);
 }
 
+//---------------------------------------------------------
+// Procedure: findInputSlots
+//            returns the sensor input slots fed by a variable, or
+//            nullptr if it isn't one of our inputs
+
+const vector<int> *NavEKF::findInputSlots(const string &key)
+{
+    auto slot = input_slots.find(key);
+    if (slot != input_slots.end()) return &(slot->second);
+    // Keys were upper-cased at registration, so only a mismatched case
+    // from the sender falls through to here.
+    slot = input_slots.find(toupper(key));
+    if (slot != input_slots.end()) return &(slot->second);
+    return nullptr;
+}
+
 //---------------------------------------------------------
 // Procedure: OnConnectToServer
 
@@ -117,52 +195,432 @@ bool NavEKF::OnDisconnectFromServer()
 
 bool NavEKF::Iterate()
 {
-    static rc_matrix_t accumulator = RC_MATRIX_INITIALIZER;
     AppCastingMOOSApp::Iterate();
     if (!nav_state) return false; // This could a nullptr if initialization failed, so avoid the crash.
     if (!(server_connected && data_good))  // Exit if no good data
     {
         AppCastingMOOSApp::PostReport();
     }
-    if (kf.step == 0)
+    if (bank) // every vehicle steps together on AppTick
     {
-        rc_matrix_duplicate(sensor_estimation_matrix, &accumulator);
-        Notify("EKF_DEBUG_OBSV", "\n" + printMatrix(&accumulator));
+        tickBank();
+        publishBank();
     }
-    nav_state->tick(&(kf.x_est)); // Run the state incrementer
+    else if (filter_rate > 0) // the worker thread runs the filter; just report on it
+    {
+        publishState();
+    }
+    else if (fusion_mode == fusion_event) // fusion and publication happen in OnNewMail
+    {
+        if (drainSamples() > 0) publishState();
+    }
+    else
+    {
+        tickFilter(sensor_inputs);
+        publishState();
+    }
+    AppCastingMOOSApp::PostReport();
+    return true;
+}
+
+//---------------------------------------------------------
+// Procedure: tickFilter()
+//            predict to now and fuse every input in y
+
+void NavEKF::tickFilter(const rc_vector_t &y)
+{
+    // Fuse only the inputs heard from within their timeouts. With none,
+    // the step is skipped, and the next one predicts across the gap.
+    double now = currentTime();
+    active_count = 0;
+    for (int a = 0; a < y.len; a++)
+    {
+        if (inputFresh(a, now)) active_rows[active_count++] = a;
+    }
+    if (active_count == 0) return;
+    if (debug_enabled && (filterStep() == 0))
+    {
+        rc_matrix_duplicate(sensor_estimation_matrix, &debug_obsv);
+        Notify("EKF_DEBUG_OBSV", "\n" + printMatrix(&debug_obsv));
+    }
+    // Step by the time that actually elapsed since the last update, so
+    // that a late or overrun tick doesn't corrupt the propagation.
+    double step_dt = (filter_rate > 0) ? (1 / filter_rate) : nav_state->getNominalTimeStep();
+    if (last_fusion_time > 0) step_dt = max(now - last_fusion_time, 0.0);
+    last_fusion_time = now;
+    double q_scale = step_dt / nav_state->getNominalTimeStep();
+    rc_vector_t x_last = (engine == engine_fixed) ? fixed_kf->estimateVector() : kf.x_est;
+    nav_state->tick(&x_last, step_dt); // Run the state incrementer
+    // The fixed engine wraps heading innovations itself; librobotcontrol
+    // has to be handed a y that's already within 180 degrees of h
+    if ((engine == engine_rc) || debug_enabled) nav_state->wrapMeasurement(y, &wrapped_y);
     // update the Kalman filter
-    if (debug_enabled && (kf.step != 0))
+    if (engine == engine_fixed)
+    {
+        if (!(fixed_kf->predict(nav_state->getF(), nav_state->getXPrediction(), q_scale) &&
+            fixed_kf->correct(nav_state->getH(), y, nav_state->getYPrediction(),
+                active_rows.data(), active_count)))
+        {
+            reportUpdateFailure();
+        }
+    }
+    else
     {
-        debug_ekf_update(&kf, nav_state->getF(), nav_state->getH(),
-            nav_state->getXPrediction(), sensor_inputs, nav_state->getYPrediction());
+        // Q is specified per nominal step
+        for (int i = 0; i < state_dim; i++) kf.Q.d[i][i] = q_scale * proc_noise_axes[i];
+        rc_matrix_t H_active = nav_state->getH();
+        rc_vector_t y_active = wrapped_y;
+        rc_vector_t h_active = nav_state->getYPrediction();
+        rc_matrix_t R_all = kf.R;
+        if (active_count < y.len)
+        {
+            active_subset->select(H_active, R_all, wrapped_y, h_active,
+                active_rows.data(), active_count);
+            H_active = active_subset->getH();
+            y_active = active_subset->getY();
+            h_active = active_subset->getYPrediction();
+            kf.R = active_subset->getR();
+        }
+        if (debug_enabled && (kf.step != 0))
+        {
+            debug_ekf_update(&kf, nav_state->getF(), H_active,
+                nav_state->getXPrediction(), y_active, h_active);
+        }
+        rc_kalman_update_ekf(&kf, nav_state->getF(), H_active,
+            nav_state->getXPrediction(), y_active, h_active);
+        kf.R = R_all;
+        nav_state->wrapState(&kf.x_est);
     }
-    rc_kalman_update_ekf(&kf, nav_state->getF(), nav_state->getH(),
-        nav_state->getXPrediction(), sensor_inputs, nav_state->getYPrediction());
     if (debug_enabled)
     {
-        Notify("EKF_DEBUG_STEP", kf.step);
-        Notify("EKF_DEBUG_F", "\n" + printMatrix(&kf.F));
-        Notify("EKF_DEBUG_H", "\n" + printMatrix(&kf.H));
-        rc_matrix_right_multiply_inplace(&accumulator, kf.F);
-        Notify("EKF_DEBUG_OBSV", "\n" + printMatrix(&accumulator));
+        Notify("EKF_DEBUG_STEP", filterStep());
+        Notify("EKF_DEBUG_F", "\n" + printMatrix(&nav_state->getF()));
+        Notify("EKF_DEBUG_H", "\n" + printMatrix(&nav_state->getH()));
+        rc_matrix_right_multiply_inplace(&debug_obsv, nav_state->getF());
+        Notify("EKF_DEBUG_OBSV", "\n" + printMatrix(&debug_obsv));
         Notify("EKF_DEBUG_X_PRED", printVector(&nav_state->getXPrediction()));
         Notify("EKF_DEBUG_Y_PRED", printVector(&nav_state->getYPrediction()));
-        Notify("EKF_DEBUG_Y_ACT", printVector(&sensor_inputs));
+        Notify("EKF_DEBUG_Y_ACT", printVector(&y));
         rc_vector_t y_err = RC_VECTOR_INITIALIZER;
-        rc_vector_subtract(sensor_inputs, nav_state->getYPrediction(), &y_err);
+        rc_vector_subtract(wrapped_y, nav_state->getYPrediction(), &y_err);
         Notify("EKF_DEBUG_Y_ERR", printVector(&y_err));
         rc_vector_free(&y_err);
     }
-    // Publish our outputs.
-    for (int i = 0; i < NavState2D::getStateCount(); i++)
+}
+
+//---------------------------------------------------------
+// Procedure: inputFresh()
+//            true if the input slot has had a sample within its
+//            timeout; in bank mode the slots run vehicle by vehicle
+
+bool NavEKF::inputFresh(int slot, double now) const
+{
+    if (slot >= (int)input_times.size()) return false;
+    const double last = input_times[slot];
+    if (last == -INFINITY) return false;
+    const double timeout = timeout_inputs[slot % timeout_inputs.size()];
+    return ((timeout == 0) || ((now - last) <= timeout));
+}
+
+//---------------------------------------------------------
+// Procedure: startBank()
+//            one filter per VEHICLE, each fed by <VEHICLE>_<INPUT> and
+//            publishing to <VEHICLE>_<OUTPUT>
+
+bool NavEKF::startBank(const rc_matrix_t &Q, const rc_matrix_t &R, const rc_matrix_t &Pi)
+{
+    int threads = bank_threads;
+    if (threads == 0) threads = max<int>(thread::hardware_concurrency(), 1);
+    bank = new FilterBank();
+    if (!bank->init(createMotionModel(model_name, autodiff_jacobian), vehicles.size(),
+        sensor_estimation_matrix, Q, R, Pi, threads))
     {
-        Notify(output_vars[i], kf.x_est.d[i]);
+        reportConfigWarning("Could not build a filter bank of " + to_string(vehicles.size()) +
+            " vehicles; the fixed engine supports at most " + to_string(max_inputs) + " inputs");
+        delete bank;
+        bank = nullptr;
+        return false;
     }
-    Notify(p_matrix_var, printMatrix(&kf.P, true, " "));
-    AppCastingMOOSApp::PostReport();
+    bank->setSequential(sequential_update);
+    // Same P and Q as the fixed engine, which has already been factored
+    if (factorized_covariance) bank->setFactorized(true);
+    bank->setAdaptive(adaptive_window, adaptive_min_scale, adaptive_max_scale);
+    bank->setGate(innovation_gate, gate_limit);
+    // Build every name once rather than on each publication
+    bank_axis_vars.clear();
+    bank_state_vars.clear();
+    bank_p_vars.clear();
+    for (auto &vehicle : vehicles)
+    {
+        for (auto &var : output_vars) bank_axis_vars.push_back(vehicle + "_" + var);
+        bank_state_vars.push_back(vehicle + "_" + state_var);
+        bank_p_vars.push_back(vehicle + "_" + p_matrix_var);
+    }
+    bank_x.resize(state_dim);
+    bank_P.resize(state_dim * state_dim);
     return true;
 }
 
+//---------------------------------------------------------
+// Procedure: tickBank()
+//            predict every vehicle to now and fuse its inputs
+
+void NavEKF::tickBank()
+{
+    const double nominal_dt = nav_state->getNominalTimeStep();
+    double now = currentTime();
+    // A vehicle with no fresh inputs is only predicted, since the bank
+    // steps together; if no vehicle has any, the step is skipped
+    active_count = 0;
+    for (int i = 0; i < sensor_inputs.len; i++)
+    {
+        bank_active[i] = inputFresh(i, now);
+        active_count += bank_active[i];
+    }
+    if (active_count == 0) return;
+    double step_dt = nominal_dt;
+    if (last_fusion_time > 0) step_dt = max(now - last_fusion_time, 0.0);
+    last_fusion_time = now;
+    int failures = bank->step(sensor_inputs.d, step_dt, step_dt / nominal_dt, bank_active.data());
+    if (failures > 0)
+    {
+        update_failures += failures;
+        reportRunWarning("EKF update failed for " + to_string(failures) + " vehicle(s)");
+    }
+}
+
+//---------------------------------------------------------
+// Procedure: publishBank()
+
+void NavEKF::publishBank()
+{
+    double now = currentTime();
+    bool axes = axis_output && ((now - last_axis_publish) >= axis_interval);
+    uint64_t rejected = 0;
+    for (int v = 0; v < (int)vehicles.size(); v++)
+    {
+        const FixedEKFBase &filter = bank->getFilter(v);
+        for (int i = 0; i < state_dim; i++) bank_x[i] = bank->getState(v, i);
+        if (innovation_gate > 0)
+        {
+            for (int a = 0; a < (int)input_vars.size(); a++) rejected += filter.getRejectCount(a);
+        }
+        if (!state_var.empty())
+        {
+            encodeNavState(composite_msg, last_fusion_time, filter.getStep(), bank_x.data(),
+                nullptr, state_dim);
+            Notify(bank_state_vars[v], composite_msg, last_fusion_time);
+        }
+        if (axes)
+        {
+            for (int i = 0; i < state_dim; i++) Notify(bank_axis_vars[(v * state_dim) + i], bank_x[i]);
+        }
+        if (p_matrix_var.empty()) continue;
+        filter.getCovariance(bank_P.data());
+        if (p_matrix_format == format_binary)
+        {
+            encodeNavState(state_msg, last_fusion_time, filter.getStep(), bank_x.data(),
+                bank_P.data(), state_dim);
+            Notify(bank_p_vars[v], state_msg, last_fusion_time);
+        }
+        else
+        {
+            Notify(bank_p_vars[v], printMatrix(bank_P.data(), state_dim, state_dim, true, " "));
+        }
+    }
+    if (axes) last_axis_publish = now;
+    // Every vehicle's dropped samples together, when there are more
+    if (rejected != rejected_published) Notify("EKF_REJECTED", (double)rejected, last_fusion_time);
+    rejected_published = rejected;
+}
+
+//---------------------------------------------------------
+// Procedure: reportUpdateFailure()
+
+void NavEKF::reportUpdateFailure()
+{
+    update_failures++;
+    // AppCasting isn't thread safe, so the worker only counts failures
+    if (filter_rate == 0) reportRunWarning("EKF update failed at step " + to_string(filterStep()));
+}
+
+//---------------------------------------------------------
+// Procedure: filterWorker()
+//            runs the filter at filter_rate until worker_running is
+//            cleared, handing each result to the MOOS thread
+
+void NavEKF::filterWorker()
+{
+    const chrono::duration<double> period(1 / filter_rate);
+    auto next = chrono::steady_clock::now();
+    sensor_sample_t sample;
+    while (worker_running.load(memory_order_acquire))
+    {
+        bool stepped = true;
+        if (fusion_mode == fusion_event)
+        {
+            stepped = (drainSamples() > 0);
+        }
+        else
+        {
+            // Only the newest value of each input matters in tick mode
+            for (int i = 0; i < input_vars.size(); i++)
+            {
+                while (sample_rings[i].pop(sample))
+                {
+                    worker_inputs.d[i] = sample.value;
+                    input_times[i] = sample.time;
+                }
+            }
+            tickFilter(worker_inputs);
+        }
+        if (stepped)
+        {
+            takeSnapshot(published.back());
+            published.publish();
+        }
+        // After an overrun, start counting again from now rather than
+        // running a burst of steps to catch up
+        next += chrono::duration_cast<chrono::steady_clock::duration>(period);
+        auto now = chrono::steady_clock::now();
+        if (next < now) next = now;
+        this_thread::sleep_until(next);
+    }
+}
+
+//---------------------------------------------------------
+// Procedure: drainSamples()
+//            fuse everything buffered since the last call, oldest
+//            first, and return how many samples were fused
+
+int NavEKF::drainSamples()
+{
+    int count = 0;
+    for (int i = 0; i < input_vars.size(); i++)
+    {
+        while (sample_rings[i].pop(pending[count])) count++;
+    }
+    // insertion sort by time; the batch is small and mostly in order
+    for (int i = 1; i < count; i++)
+    {
+        sensor_sample_t sample = pending[i];
+        int j = i - 1;
+        for (; (j >= 0) && (pending[j].time > sample.time); j--) pending[j + 1] = pending[j];
+        pending[j + 1] = sample;
+    }
+    for (int i = 0; i < count; i++) processSample(pending[i]);
+    return count;
+}
+
+//---------------------------------------------------------
+// Procedure: processSample()
+//            a sample older than the last fusion is fused at its own
+//            time by rewinding to the snapshot before it and replaying
+//            everything fused since
+
+void NavEKF::processSample(const sensor_sample_t &sample)
+{
+    if ((last_fusion_time == 0) || (sample.time >= last_fusion_time))
+    {
+        fuseSample(sample);
+        return;
+    }
+    int before = history.findBefore(sample.time);
+    if (before < 0)
+    {
+        // Too old to replay, so fuse it against the current state
+        samples_stale++;
+        fuseSample(sample);
+        return;
+    }
+    int replay_count = 0;
+    for (int i = before + 1; i < history.size(); i++) replay[replay_count++] = history.at(i).sample;
+    filter_snapshot_t<max_state_count> &snap = history.at(before);
+    fixed_kf->setState(snap.x, snap.P);
+    last_fusion_time = snap.sample.time;
+    history.truncate(before + 1);
+    fuseSample(sample);
+    // Those were counted toward the noise estimates and the gate already
+    fixed_kf->setReplaying(true);
+    for (int i = 0; i < replay_count; i++) fuseSample(replay[i]);
+    fixed_kf->setReplaying(false);
+    samples_replayed++;
+}
+
+//---------------------------------------------------------
+// Procedure: fuseSample()
+//            predict to the sample time and fuse only that input
+
+void NavEKF::fuseSample(const sensor_sample_t &sample)
+{
+    double step_dt = 0;
+    bool in_order = (last_fusion_time == 0) || (sample.time >= last_fusion_time);
+    if (last_fusion_time > 0) step_dt = max(sample.time - last_fusion_time, 0.0);
+    if (in_order) last_fusion_time = sample.time;
+    input_times[sample.slot] = max(input_times[sample.slot], sample.time);
+    rc_vector_t x_last = fixed_kf->estimateVector();
+    nav_state->tick(&x_last, step_dt);
+    // Q is specified per nominal AppTick step, so scale it to the actual interval
+    fixed_kf->predict(nav_state->getF(), nav_state->getXPrediction(),
+        step_dt / nav_state->getNominalTimeStep());
+    sample_y.d[sample.slot] = sample.value;
+    if (!fixed_kf->correct(nav_state->getH(), sample_y, nav_state->getYPrediction(),
+        &sample.slot, 1))
+    {
+        reportUpdateFailure();
+    }
+    // Only in-order fusions can be rewound to
+    if (!in_order) return;
+    filter_snapshot_t<max_state_count> &snap = history.push();
+    snap.sample = sample;
+    const double *x_est = fixed_kf->getEstimate();
+    for (int i = 0; i < state_dim; i++) snap.x[i] = x_est[i];
+    fixed_kf->getCovariance(snap.P);
+}
+
+//---------------------------------------------------------
+// Procedure: publishState()
+
+void NavEKF::publishState()
+{
+    if (offline) return; // a replay records the state itself
+    const state_snapshot_t<max_state_count, max_inputs> &state = latestState();
+    // The whole estimate in one message
+    if (!state_var.empty())
+    {
+        encodeNavState(composite_msg, state.time, state.step, state.x, nullptr, state.n);
+        Notify(state_var, composite_msg, state.time);
+    }
+    if (innovation_gate > 0)
+    {
+        // Only when another sample has been dropped
+        uint64_t rejected = 0;
+        for (int a = 0; a < state.m; a++) rejected += state.rejected[a];
+        if (rejected != rejected_published) Notify("EKF_REJECTED", (double)rejected, state.time);
+        rejected_published = rejected;
+    }
+    double now = currentTime();
+    if (axis_output && ((now - last_axis_publish) >= axis_interval))
+    {
+        for (int i = 0; i < state.n; i++)
+        {
+            Notify(output_vars[i], state.x[i]);
+        }
+        last_axis_publish = now;
+    }
+    if (p_matrix_var.empty()) return;
+    if (p_matrix_format == format_binary)
+    {
+        // Stamped with the time the estimate is valid at
+        encodeNavState(state_msg, state.time, state.step, state.x, state.P, state.n);
+        Notify(p_matrix_var, state_msg, state.time);
+    }
+    else
+    {
+        Notify(p_matrix_var, printMatrix(state.P, state.n, state.n, true, " "));
+    }
+}
+
 //---------------------------------------------------------
 // Procedure: OnStartUp()
 //            happens before connection is open
@@ -188,20 +646,47 @@ bool NavEKF::OnStartUp()
         if (param == "INPUT")
         {
             input_vars.push_back(toupper(value));
+            input_noise.push_back(NAN);
+            input_timeout.push_back(NAN);
             handled = true;
         }
+        else if ((param == "INPUT_NOISE") && !input_noise.empty())
+        {
+            // Variance of the INPUT above, in place of MEASUREMENT_NOISE
+            input_noise.back() = stod(value);
+            handled = (input_noise.back() > 0);
+        }
+        else if ((param == "INPUT_TIMEOUT") && !input_timeout.empty())
+        {
+            // Timeout of the INPUT above, in place of SENSOR_TIMEOUT
+            input_timeout.back() = stod(value);
+            handled = (input_timeout.back() >= 0);
+        }
+        else if (param == "SENSOR_TIMEOUT")
+        {
+            sensor_timeout = stod(value);
+            handled = (sensor_timeout >= 0);
+        }
         else if (param == "INPUT_TYPE")
         {
-            string val = toupper(value);
-            int8_t type_len = input_types.size();
-            if (val == "X")            input_types.push_back(state_axis_t::x);
-            else if (val == "Y")       input_types.push_back(state_axis_t::y);
-            else if (val == "THETA")   input_types.push_back(state_axis_t::theta);
-            else if (val == "V")       input_types.push_back(state_axis_t::v);
-            else if (val == "THETA_DOT") input_types.push_back(state_axis_t::theta_dot);
-            else if (val == "V_DOT")   input_types.push_back(state_axis_t::v_dot);
-            // This is only true if the input type was a valid one.
-            if (input_types.size() > type_len) handled = true;
+            // Checked against the model's axes once the model is known
+            input_type_names.push_back(toupper(value));
+            handled = true;
+        }
+        else if (param == "MOTION_MODEL")
+        {
+            model_name = toupper(value);
+            handled = true;
+        }
+        else if (param == "VEHICLE")
+        {
+            vehicles.push_back(toupper(value));
+            handled = true;
+        }
+        else if (param == "BANK_THREADS")
+        {
+            bank_threads = stoi(value);
+            handled = (bank_threads >= 0);
         }
         else if (param == "PROCESS_NOISE")
         {
@@ -213,40 +698,110 @@ bool NavEKF::OnStartUp()
             meas_noise = stof(value);
             handled = true;
         }
-        else if (param == "X_OUT")
+        else if (param == "P_MATRIX_OUT")
         {
-            output_vars[state_axis_t::x] = value;
+            p_matrix_var = value;
             handled = true;
         }
-        else if (param == "Y_OUT")
+        else if (param == "STATE_OUT")
         {
-            output_vars[state_axis_t::y] = value;
+            state_var = value;
             handled = true;
         }
-        else if (param == "THETA_OUT")
+        else if ((param.size() > 14) && (param.compare(param.size() - 14, 14, "_PROCESS_NOISE") == 0))
         {
-            output_vars[state_axis_t::theta] = value;
-            handled = true;
+            // <AXIS>_PROCESS_NOISE, in place of PROCESS_NOISE for that axis
+            double &noise = axis_noise[param.substr(0, param.size() - 14)];
+            noise = stod(value);
+            handled = (noise > 0);
         }
-        else if (param == "V_OUT")
+        else if ((param.size() > 4) && (param.compare(param.size() - 4, 4, "_OUT") == 0))
         {
-            output_vars[state_axis_t::v] = value;
+            // <AXIS>_OUT, e.g. X_OUT or THETA_DOT_OUT, for any axis of the model
+            axis_outputs[param.substr(0, param.size() - 4)] = value;
             handled = true;
         }
-        else if (param == "THETA_DOT_OUT")
+        else if (param == "AXIS_OUTPUT")
         {
-            output_vars[state_axis_t::theta_dot] = value;
-            handled = true;
+            handled = setBooleanOnString(axis_output, value);
         }
-        else if (param == "V_DOT_OUT")
+        else if (param == "AXIS_OUTPUT_INTERVAL")
         {
-            output_vars[state_axis_t::v_dot] = value;
-            handled = true;
+            axis_interval = stod(value);
+            handled = (axis_interval >= 0);
         }
-        else if (param == "P_MATRIX_OUT")
+        else if (param == "P_MATRIX_FORMAT")
         {
-            p_matrix_var = value;
-            handled = true;
+            string val = toupper(value);
+            if (val == "TEXT")          p_matrix_format = format_text;
+            else if (val == "BINARY")   p_matrix_format = format_binary;
+            handled = ((val == "TEXT") || (val == "BINARY"));
+        }
+        else if (param == "ENGINE")
+        {
+            string val = toupper(value);
+            if (val == "RC")            engine = engine_rc;
+            else if (val == "FIXED")    engine = engine_fixed;
+            handled = ((val == "RC") || (val == "FIXED"));
+        }
+        else if (param == "FUSION_MODE")
+        {
+            string val = toupper(value);
+            if (val == "TICK")          fusion_mode = fusion_tick;
+            else if (val == "EVENT")    fusion_mode = fusion_event;
+            handled = ((val == "TICK") || (val == "EVENT"));
+        }
+        else if (param == "UPDATE_MODE")
+        {
+            string val = toupper(value);
+            if (val == "JOINT")             sequential_update = false;
+            else if (val == "SEQUENTIAL")   sequential_update = true;
+            update_auto = (val == "AUTO");
+            handled = ((val == "JOINT") || (val == "SEQUENTIAL") || update_auto);
+        }
+        else if (param == "COVARIANCE_FORM")
+        {
+            string val = toupper(value);
+            if (val == "STANDARD")  factorized_covariance = false;
+            else if (val == "UD")   factorized_covariance = true;
+            handled = ((val == "STANDARD") || (val == "UD"));
+        }
+        else if (param == "ADAPTIVE_WINDOW")
+        {
+            adaptive_window = stoi(value);
+            handled = ((adaptive_window >= 0) && (adaptive_window <= adaptive_depth));
+        }
+        else if (param == "ADAPTIVE_MIN_SCALE")
+        {
+            adaptive_min_scale = stod(value);
+            handled = (adaptive_min_scale > 0);
+        }
+        else if (param == "ADAPTIVE_MAX_SCALE")
+        {
+            adaptive_max_scale = stod(value);
+            handled = (adaptive_max_scale > 0);
+        }
+        else if (param == "INNOVATION_GATE")
+        {
+            innovation_gate = stod(value);
+            handled = (innovation_gate >= 0);
+        }
+        else if (param == "INNOVATION_GATE_LIMIT")
+        {
+            gate_limit = stoi(value);
+            handled = (gate_limit >= 0);
+        }
+        else if (param == "JACOBIAN")
+        {
+            string val = toupper(value);
+            if (val == "ANALYTIC")          autodiff_jacobian = false;
+            else if (val == "AUTODIFF")     autodiff_jacobian = true;
+            handled = ((val == "ANALYTIC") || (val == "AUTODIFF"));
+        }
+        else if (param == "FILTER_RATE")
+        {
+            filter_rate = stod(value);
+            handled = (filter_rate >= 0);
         }
         else if (param == "ENABLE_EKF_DEBUG")
         {
@@ -257,30 +812,183 @@ bool NavEKF::OnStartUp()
         if(!handled) reportUnhandledConfigWarning(orig);
     }
 
+    // Partial and sequential updates are only implemented by the fixed engine
+    if (update_auto) sequential_update = false;
+    if ((fusion_mode == fusion_event) && (engine != engine_fixed))
+    {
+        reportConfigWarning("FUSION_MODE = EVENT requires ENGINE = FIXED; using the fixed engine");
+        engine = engine_fixed;
+    }
+    if (sequential_update && (engine != engine_fixed))
+    {
+        reportConfigWarning("UPDATE_MODE = SEQUENTIAL requires ENGINE = FIXED; using the fixed engine");
+        engine = engine_fixed;
+    }
+    if (factorized_covariance && (engine != engine_fixed))
+    {
+        reportConfigWarning("COVARIANCE_FORM = UD requires ENGINE = FIXED; using the fixed engine");
+        engine = engine_fixed;
+    }
+    if ((adaptive_window > 0) && (engine != engine_fixed))
+    {
+        reportConfigWarning("ADAPTIVE_WINDOW requires ENGINE = FIXED; using the fixed engine");
+        engine = engine_fixed;
+    }
+    if ((innovation_gate > 0) && (engine != engine_fixed))
+    {
+        reportConfigWarning("INNOVATION_GATE requires ENGINE = FIXED; using the fixed engine");
+        engine = engine_fixed;
+    }
+    if ((adaptive_window > 0) && (adaptive_max_scale < adaptive_min_scale))
+    {
+        reportConfigWarning("ADAPTIVE_MAX_SCALE is below ADAPTIVE_MIN_SCALE; using fixed R");
+        adaptive_window = 0;
+    }
+    // The filter bank steps every vehicle together on AppTick
+    if (!vehicles.empty())
+    {
+        if (engine != engine_fixed)
+        {
+            reportConfigWarning("VEHICLE requires ENGINE = FIXED; using the fixed engine");
+            engine = engine_fixed;
+        }
+        if (fusion_mode != fusion_tick)
+        {
+            reportConfigWarning("VEHICLE requires FUSION_MODE = TICK; using tick mode");
+            fusion_mode = fusion_tick;
+        }
+        if (filter_rate > 0)
+        {
+            reportConfigWarning("VEHICLE can't be used with FILTER_RATE; filtering on AppTick");
+            filter_rate = 0;
+        }
+    }
+    // A replayed log sets the pace, so there's no worker thread to run
+    if (offline)
+    {
+        if (filter_rate > 0)
+        {
+            reportConfigWarning("FILTER_RATE is ignored in log replay; filtering on AppTick");
+            filter_rate = 0;
+        }
+        if (!vehicles.empty())
+        {
+            reportConfigWarning("VEHICLE can't be used in log replay");
+            return false;
+        }
+    }
+    // Only the snapshot crosses from the worker to the MOOS thread, and
+    // the debug output is far more than it carries
+    if (debug_enabled && (filter_rate > 0))
+    {
+        reportConfigWarning("ENABLE_EKF_DEBUG can't be used with FILTER_RATE; debug output is off");
+        debug_enabled = false;
+    }
+    MotionModel *model = createMotionModel(model_name, autodiff_jacobian);
+    if (!model)
+    {
+        reportConfigWarning("Unknown MOTION_MODEL " + model_name + "; using CTRA");
+        model_name = "CTRA";
+        model = createMotionModel(model_name, autodiff_jacobian);
+    }
+    state_dim = model->getStateCount();
     // If the sensor matrix doesn't populate, nothing else will work, so bail.
-    if (!buildSensorMatrix()) return false;
-    // Initialize the state object
-    nav_state = new NavState2D(sensor_estimation_matrix, (1/GetAppFreq()));
+    if (!(resolveAxes(model) && buildSensorMatrix()))
+    {
+        delete model;
+        return false;
+    }
+    // Scalar updates are only worth asking for if the fixed engine is
+    // running anyway, and it only takes them for a diagonal R
+    if (update_auto) sequential_update = (engine == engine_fixed);
+    // Initialize the state object, which takes over the model
+    nav_state = new NavState2D(sensor_estimation_matrix, (1/GetAppFreq()), model);
     rc_matrix_t meas_noise_m = rc_matrix_empty();
     rc_matrix_t proc_noise_m = rc_matrix_empty();
     rc_matrix_t Pi = rc_matrix_empty();
-    // Our assumption here is that the process and measurement covariance
-    // matrices are both equal to lambda * I, where I is the identity matrix
-    // of the correct size and lambda is any real number and is provided
-    // by the configuration file...
-    rc_matrix_identity(&meas_noise_m, sensor_estimation_matrix.rows);
-    rc_matrix_identity(&proc_noise_m, NavState2D::getStateCount());
-    rc_matrix_times_scalar(&meas_noise_m, meas_noise);
-    rc_matrix_times_scalar(&proc_noise_m, proc_noise);
+    // Our assumption here is that the process and measurement noise are
+    // independent between axes and between inputs, so both covariance
+    // matrices are diagonal. Each entry is the configured variance for
+    // that axis or input, or PROCESS_NOISE or MEASUREMENT_NOISE if none.
+    rc_matrix_zeros(&meas_noise_m, sensor_estimation_matrix.rows, sensor_estimation_matrix.rows);
+    rc_matrix_zeros(&proc_noise_m, state_dim, state_dim);
+    for (int i = 0; i < sensor_estimation_matrix.rows; i++) meas_noise_m.d[i][i] = meas_noise_inputs[i];
+    for (int i = 0; i < state_dim; i++) proc_noise_m.d[i][i] = proc_noise_axes[i];
     // Our initial noise estimate is just the identity matrix.
-    rc_matrix_identity(&Pi, NavState2D::getStateCount());
+    rc_matrix_identity(&Pi, state_dim);
     rc_kalman_alloc_ekf(&kf, proc_noise_m, meas_noise_m, Pi);
+    // A filter built for exactly the model's state count
+    fixed_kf = newFixedEKF<max_inputs, cov_real_t>(state_dim);
+    if ((engine == engine_fixed) && !fixed_kf->init(proc_noise_m, meas_noise_m, Pi))
+    {
+        reportConfigWarning("Fixed EKF supports at most " + to_string(max_inputs) +
+            " inputs; falling back to the rc engine");
+        engine = engine_rc;
+        fusion_mode = fusion_tick;
+        adaptive_window = 0;
+        innovation_gate = 0;
+    }
+    fixed_kf->setSequential(sequential_update);
+    fixed_kf->setSelection(sensor_estimation_matrix);
+    fixed_kf->setWrapAxes(nav_state->getWrapAxes());
+    if (factorized_covariance && !fixed_kf->setFactorized(true))
+    {
+        reportConfigWarning("Could not factor P and Q for COVARIANCE_FORM = UD; using STANDARD");
+        factorized_covariance = false;
+    }
+    // R has to be diagonal, which it always is when built from the config
+    fixed_kf->setAdaptive(adaptive_window, adaptive_min_scale, adaptive_max_scale);
+    fixed_kf->setGate(innovation_gate, gate_limit);
+    bool bank_ok = vehicles.empty() || startBank(proc_noise_m, meas_noise_m, Pi);
     // These matrices have no further purpose after initializing the EKF
     rc_matrix_free(&proc_noise_m);
     rc_matrix_free(&meas_noise_m);
     rc_matrix_free(&Pi);
-    rc_vector_zeros(&sensor_inputs, input_vars.size());
+    if (!bank_ok) return false;
+    // In bank mode the inputs are laid out vehicle by vehicle
+    const int inputs = input_vars.size();
+    rc_vector_zeros(&sensor_inputs, inputs * max<int>(vehicles.size(), 1));
+    rc_vector_zeros(&sample_y, inputs);
+    rc_vector_zeros(&wrapped_y, inputs);
+    input_times.assign(sensor_inputs.len, -INFINITY);
+    active_rows.assign(inputs, 0);
+    bank_active.assign(sensor_inputs.len, 0);
+    if (active_subset) delete active_subset;
+    active_subset = new MeasurementSubset(inputs, state_dim);
+    // Map each input variable to the sensor slot(s) it feeds so that
+    // mail dispatch is a single hash lookup.
+    input_slots.clear();
+    if (bank)
+    {
+        for (int v = 0; v < (int)vehicles.size(); v++)
+        {
+            for (int i = 0; i < inputs; i++)
+            {
+                input_slots[vehicles[v] + "_" + input_vars[i]].push_back((v * inputs) + i);
+            }
+        }
+    }
+    else
+    {
+        for (int i = 0; i < inputs; i++) input_slots[input_vars[i]].push_back(i);
+    }
     registerVariables();
+    if (filter_rate > 0)
+    {
+        if (input_vars.size() > max_inputs)
+        {
+            reportConfigWarning("FILTER_RATE supports at most " + to_string(max_inputs) +
+                " inputs; filtering on AppTick instead");
+            filter_rate = 0;
+            return(true);
+        }
+        // Hand over the initial state so there's always something to read
+        rc_vector_zeros(&worker_inputs, input_vars.size());
+        takeSnapshot(published.back());
+        published.publish();
+        worker_running = true;
+        worker = thread(&NavEKF::filterWorker, this);
+    }
     return(true);
 }
 
@@ -290,21 +998,72 @@ bool NavEKF::OnStartUp()
 void NavEKF::registerVariables()
 {
     AppCastingMOOSApp::RegisterVariables();
-    for (auto &var : input_vars)
+    for (auto &slot : input_slots)
     {
-        Register(var, 0);
+        Register(slot.first, 0);
     }
 }
 
 //---------------------------------------------------------
-// Procedure: registerVariables
+// Procedure: resolveAxes
+//            map the axis names from the config onto the model's
+//            states and name the output variables
+
+bool NavEKF::resolveAxes(const MotionModel *model)
+{
+    bool ok = true;
+    input_types.clear();
+    for (auto &name : input_type_names)
+    {
+        int axis = model->findAxis(name);
+        if (axis < 0)
+        {
+            reportConfigWarning("INPUT_TYPE " + name + " is not an axis of MOTION_MODEL " + model_name);
+            ok = false;
+            continue;
+        }
+        input_types.push_back(axis);
+    }
+    // Outputs default to EKF_<AXIS>
+    output_vars.assign(state_dim, "");
+    for (int i = 0; i < state_dim; i++) output_vars[i] = string("EKF_") + model->getAxisName(i);
+    for (auto &out : axis_outputs)
+    {
+        int axis = model->findAxis(out.first);
+        if (axis < 0)
+        {
+            reportConfigWarning(out.first + "_OUT is not an axis of MOTION_MODEL " + model_name);
+            continue;
+        }
+        output_vars[axis] = out.second;
+    }
+    proc_noise_axes.assign(state_dim, proc_noise);
+    for (auto &noise : axis_noise)
+    {
+        int axis = model->findAxis(noise.first);
+        if (axis < 0)
+        {
+            reportConfigWarning(noise.first + "_PROCESS_NOISE is not an axis of MOTION_MODEL " + model_name);
+            continue;
+        }
+        proc_noise_axes[axis] = noise.second;
+    }
+    meas_noise_inputs.clear();
+    for (double noise : input_noise) meas_noise_inputs.push_back(isnan(noise) ? meas_noise : noise);
+    timeout_inputs.clear();
+    for (double timeout : input_timeout) timeout_inputs.push_back(isnan(timeout) ? sensor_timeout : timeout);
+    return ok;
+}
+
+//---------------------------------------------------------
+// Procedure: buildSensorMatrix
 
 bool NavEKF::buildSensorMatrix()
 {
     // The assumption here is that all sensor inputs represent
     // exactly one state and are in the same units with no offsets.
     // Therefore, each row of the sensor matrix H is assumed to have
-    // a single 1 and state_count - 1 zeros.
+    // a single 1 and state_dim - 1 zeros.
     if (input_vars.size() != input_types.size())
     {
         cout << "Input vars size: " << input_vars.size() << endl;
@@ -313,38 +1072,42 @@ bool NavEKF::buildSensorMatrix()
         for (auto &a : input_types) cout << a << endl;
         return false;
     }
-    rc_matrix_zeros(&sensor_estimation_matrix, input_vars.size(),
-        NavState2D::getStateCount());
+    rc_matrix_zeros(&sensor_estimation_matrix, input_vars.size(), state_dim);
     for (int i = 0; i < input_vars.size(); i++)
     {
-        // sensor_estimation_matrix.d[i][input_types[i]] = 1;
-        sensor_estimation_matrix.d[input_types[i]][i] = 1;
+        sensor_estimation_matrix.d[i][input_types[i]] = 1;
     }
     return true;
 }
 
 
 string NavEKF::printMatrix(const rc_matrix_t* m, bool sci, string sep)
+{
+    // librobotcontrol allocates the matrix body as one contiguous block
+    return printMatrix(m->d[0], m->rows, m->cols, sci, sep);
+}
+
+string NavEKF::printMatrix(const double* m, int rows, int cols, bool sci, string sep)
 {
     stringstream out;
     out << fixed << setprecision(5);
     if (sci) out << scientific << setprecision(3);
     out << "[";
-    for (int i = 0; i < (m->rows - 1); i++)
+    for (int i = 0; i < (rows - 1); i++)
     {
         out << "[";
-        for (int j = 0; j < (m->cols - 1); j++)
+        for (int j = 0; j < (cols - 1); j++)
         {
-            out << m->d[i][j] << ", ";
+            out << m[(i * cols) + j] << ", ";
         }
-        out << m->d[i][m->cols - 1] << "]," << sep;
+        out << m[(i * cols) + cols - 1] << "]," << sep;
     }
     out << "[";
-    for (int j = 0; j < (m->cols - 1); j++)
+    for (int j = 0; j < (cols - 1); j++)
     {
-        out << m->d[m->rows - 1][j] << ", ";
+        out << m[((rows - 1) * cols) + j] << ", ";
     }
-    out << m->d[m->rows - 1][m->cols - 1] << " ]]";
+    out << m[(rows * cols) - 1] << " ]]";
     return out.str();
 }
 
@@ -366,28 +1129,142 @@ bool NavEKF::buildReport()
   m_msgs << "File: pNavEKF \n";
   m_msgs << "============================================ \n";
 
+  if (bank)
+  {
+    ACTable bank_tab(state_dim + 1);
+    bank_tab << "Vehicle";
+    for (int i = 0; i < state_dim; i++) bank_tab << output_vars[i];
+    for (int v = 0; v < (int)vehicles.size(); v++)
+    {
+      bank_tab << vehicles[v];
+      for (int i = 0; i < state_dim; i++) bank_tab << to_string(bank->getState(v, i));
+    }
+    m_msgs << "Filter bank: " << vehicles.size() << " vehicles on " << bank->getThreadCount() << " thread(s)\n";
+    m_msgs << "Motion model: " << model_name << " (" << state_dim << " states)\n\n";
+    m_msgs << bank_tab.getFormattedString();
+    if (update_failures > 0) m_msgs << "\nFailed updates: " << update_failures.load() << "\n";
+    if (innovation_gate > 0) m_msgs << "\nSamples rejected by the gate: " << rejected_published << "\n";
+    m_msgs << "\nActive inputs: " << active_count << " of " << sensor_inputs.len << "\n";
+    return(true);
+  }
+
   ACTable state_tab(output_vars.size());
   ACTable state_est_tab(output_vars.size());
   ACTable sensor_tab(input_vars.size());
   for (int i = 0; i < input_vars.size(); i++) sensor_tab << input_vars[i];
   for (int i = 0; i < input_vars.size(); i++) sensor_tab <<  to_string(sensor_inputs.d[i]);
+  const state_snapshot_t<max_state_count, max_inputs> &state = latestState();
   for (int i = 0; i < output_vars.size(); i++) state_tab << output_vars[i];
-  for (int i = 0; i < output_vars.size(); i++) state_tab << to_string(kf.x_est.d[i]);
+  for (int i = 0; i < output_vars.size(); i++) state_tab << to_string(state.x[i]);
   for (int i = 0; i < output_vars.size(); i++) state_est_tab << output_vars[i];
-  for (int i = 0; i < output_vars.size(); i++) state_est_tab << to_string(kf.x_pre.d[i]);
+  for (int i = 0; i < output_vars.size(); i++) state_est_tab << to_string(state.x_pre[i]);
 
-  m_msgs << "Input Variables\n";
+  if (adaptive_window > 0)
+  {
+    // The noise each input is trusted at now, against its configured noise
+    for (int i = 0; i < state.m; i++) sensor_tab << ("x" + doubleToString(state.noise_scale[i], 2));
+  }
+  if (innovation_gate > 0)
+  {
+    for (int i = 0; i < state.m; i++) sensor_tab << (to_string(state.rejected[i]) + " rejected");
+  }
+  // Inputs past their timeout are left out of H until they report again
+  // (or not yet heard from). The rc engine may have more inputs than a
+  // snapshot holds, but then it runs on this thread and can be asked.
+  int active = 0;
+  for (int i = 0; i < input_vars.size(); i++)
+  {
+    bool fresh = (i < state.m) ? state.active[i] : inputFresh(i, currentTime());
+    sensor_tab << (fresh ? "active" : "inactive");
+    active += fresh;
+  }
+  m_msgs << "Input Variables (" << active << " of " << input_vars.size() << " active)\n";
   m_msgs << sensor_tab.getFormattedString();
   m_msgs << "\nPredicted State Variables\n";
   m_msgs << state_est_tab.getFormattedString();
   m_msgs << "\nEstimated State Variables\n";
   m_msgs << state_tab.getFormattedString();
+  if (fusion_mode == fusion_event)
+  {
+    m_msgs << "\nSamples replayed out of sequence: " << samples_replayed.load() << "\n";
+    m_msgs << "Samples too old to replay: " << samples_stale.load() << "\n";
+    m_msgs << "Samples dropped on full buffers: " << samples_dropped << "\n";
+  }
+  if (filter_rate > 0) m_msgs << "\nFilter thread rate: " << filter_rate << " Hz, step " << state.step << "\n";
+  if (update_failures > 0) m_msgs << "Failed updates: " << update_failures.load() << "\n";
+  if (!state_var.empty()) m_msgs << "\nComposite state output: " << state_var << "\n";
+  if (!axis_output) m_msgs << "Per-axis output: off\n";
+  else if (axis_interval > 0) m_msgs << "Per-axis output every " << axis_interval << " s\n";
+  m_msgs << "\nMotion model: " << model_name << " (" << state_dim << " states)\n";
   m_msgs << "\nCovariance Matrix\n";
-  m_msgs << printMatrix(&kf.P, true);
+  m_msgs << printMatrix(state.P, state.n, state.n, true);
 
   return(true);
 }
 
+//------------------------------------------------------------
+// Accessors for whichever filter engine is running
+
+// Whatever the MOOS side reports from: the worker's latest hand-off if
+// there is a worker, otherwise the filter itself.
+const state_snapshot_t<max_state_count, max_inputs> &NavEKF::latestState()
+{
+    if (filter_rate > 0)
+    {
+        published.update();
+        return published.front();
+    }
+    takeSnapshot(local_state);
+    return local_state;
+}
+
+void NavEKF::takeSnapshot(state_snapshot_t<max_state_count, max_inputs> &snap)
+{
+    snap.n = state_dim;
+    snap.m = min<int>(input_vars.size(), max_inputs);
+    snap.time = last_fusion_time;
+    snap.step = filterStep();
+    const double now = currentTime();
+    for (int a = 0; a < snap.m; a++)
+    {
+        snap.noise_scale[a] = 1;
+        snap.rejected[a] = 0;
+        snap.active[a] = inputFresh(a, now);
+    }
+    if (engine == engine_fixed)
+    {
+        if (adaptive_window > 0)
+        {
+            for (int a = 0; a < snap.m; a++) snap.noise_scale[a] = fixed_kf->getNoiseScale(a);
+        }
+        if (innovation_gate > 0)
+        {
+            for (int a = 0; a < snap.m; a++) snap.rejected[a] = fixed_kf->getRejectCount(a);
+        }
+        const double *x_est = fixed_kf->getEstimate();
+        const double *x_pre = fixed_kf->getPrediction();
+        for (int i = 0; i < state_dim; i++)
+        {
+            snap.x[i] = x_est[i];
+            snap.x_pre[i] = x_pre[i];
+        }
+        fixed_kf->getCovariance(snap.P);
+        return;
+    }
+    for (int i = 0; i < state_dim; i++)
+    {
+        snap.x[i] = kf.x_est.d[i];
+        snap.x_pre[i] = kf.x_pre.d[i];
+        for (int j = 0; j < state_dim; j++) snap.P[(i * state_dim) + j] = kf.P.d[i][j];
+    }
+}
+
+uint64_t NavEKF::filterStep()
+{
+    if (engine == engine_fixed) return fixed_kf->getStep();
+    return kf.step;
+}
+
 void NavEKF::debug_ekf_update(
     rc_kalman_t* kf,
     rc_matrix_t F,
@@ -10,17 +10,48 @@
 
 #include "MOOS/libMOOS/Thirdparty/AppCasting/AppCastingMOOSApp.h"
 #include "NavEKF_increment.h"
+#include "NavEKF_fixed.h"
+#include "NavEKF_buffer.h"
+#include "NavEKF_codec.h"
+#include "NavEKF_bank.h"
 #include <vector>
 #include <string>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
 
 using namespace std;
 
+// Samples buffered per input between fusions in event mode
+const int sample_depth = 32;
+// Fused samples remembered for re-fusing out-of-sequence measurements
+const int history_depth = 64;
+
+enum ekf_engine_t : uint8_t {
+    engine_rc       = 0,    // librobotcontrol rc_kalman_update_ekf
+    engine_fixed    = 1     // FixedEKF, no per-step allocation
+};
+
+enum fusion_mode_t : uint8_t {
+    fusion_tick     = 0,    // predict and fuse every input once per AppTick
+    fusion_event    = 1     // predict to each sample's time and fuse just that input
+};
+
+enum matrix_format_t : uint8_t {
+    format_text     = 0,    // printMatrix() string of P
+    format_binary   = 1     // NavEKF_codec.h message of x, P and time
+};
+
 class NavEKF : public AppCastingMOOSApp
 {
+    // Log replay and tuning read the configuration back out
+    friend class NavReplay;
+
 public:
     NavEKF();
     ~NavEKF();
     string printMatrix(const rc_matrix_t* m, bool sci=false, string sep="\n");
+    string printMatrix(const double* m, int rows, int cols, bool sci=false, string sep="\n");
     string printVector(const rc_vector_t* v);
 
 protected: // Standard MOOSApp functions to overload
@@ -35,19 +66,116 @@ protected: // Standard AppCastingMOOSApp function to overload
 
 protected:
     void registerVariables();
+    const vector<int> *findInputSlots(const string &key);
+    bool resolveAxes(const MotionModel *model);
     bool buildSensorMatrix();
+    int drainSamples();
+    void processSample(const sensor_sample_t &sample);
+    void fuseSample(const sensor_sample_t &sample);
+    void tickFilter(const rc_vector_t &y);
+    bool inputFresh(int slot, double now) const;
+    bool startBank(const rc_matrix_t &Q, const rc_matrix_t &R, const rc_matrix_t &Pi);
+    void tickBank();
+    void publishBank();
+    void reportUpdateFailure();
+    void filterWorker();
+    void publishState();
+    const state_snapshot_t<max_state_count, max_inputs> &latestState();
+    void takeSnapshot(state_snapshot_t<max_state_count, max_inputs> &snap);
+    uint64_t filterStep();
+    // Clock the filter steps and publishes against. Log replay
+    // substitutes the log's own clock.
+    virtual double currentTime() {return MOOSTime();};
+    const vector<string> &getOutputVars() const {return output_vars;};
     void debug_ekf_update(rc_kalman_t* kf, rc_matrix_t F, rc_matrix_t H, rc_vector_t x_pre, rc_vector_t y, rc_vector_t h);
 
+protected:
+    // Set before OnStartUp() when the app is driven from a log rather
+    // than a MOOSDB. Filtering stays on the calling thread and nothing
+    // is published.
+    bool offline;
+
 private: // Configuration variable
+    string model_name;
     vector<string> input_vars;
-    vector<state_axis_t> input_types;
+    vector<string> input_type_names;
+    vector<int> input_types;
+    vector<double> input_noise;     // INPUT_NOISE of each input, NAN for MEASUREMENT_NOISE
+    vector<double> input_timeout;   // INPUT_TIMEOUT of each input, NAN for SENSOR_TIMEOUT
+    unordered_map<string, double> axis_noise;      // <AXIS>_PROCESS_NOISE by axis name
+    unordered_map<string, string> axis_outputs;    // <AXIS>_OUT by axis name
+    vector<string> vehicles;    // filter bank vehicle prefixes, if any
+    int bank_threads;           // most threads for the filter bank, 0 for one per core
+    unordered_map<string, vector<int>> input_slots;
     vector<string> output_vars;
     string p_matrix_var;
+    matrix_format_t p_matrix_format;
+    string state_var;           // composite state message, if set
+    bool axis_output;
+    double axis_interval;       // minimum seconds between per-axis publications
 
 private: // State variables
     double proc_noise;
     double meas_noise;
+    vector<double> proc_noise_axes;     // diagonal of Q, by state
+    vector<double> meas_noise_inputs;   // diagonal of R, by input
+    double sensor_timeout;      // seconds an input is fused for after its last sample, 0 for ever
+    vector<double> timeout_inputs;      // by input
+    ekf_engine_t engine;
+    fusion_mode_t fusion_mode;
+    bool sequential_update;
+    bool update_auto;           // sequential whenever R is diagonal
+    bool factorized_covariance;
+    int adaptive_window;        // innovations per input to estimate R from, 0 for fixed R
+    double adaptive_min_scale;
+    double adaptive_max_scale;
+    double innovation_gate;     // chi-square limit on each innovation, 0 for none
+    int gate_limit;             // rejections in a row before an input is let back in
+    uint64_t rejected_published;
+    bool autodiff_jacobian;
+    int state_dim;              // states in the motion model
+    double filter_rate;         // worker thread rate in Hz, or 0 to filter on the MOOS thread
+    double last_fusion_time;
+    SampleRing<sensor_sample_t, sample_depth> sample_rings[max_inputs];
+    FilterHistory<max_state_count, history_depth> history;
+    sensor_sample_t pending[max_inputs * sample_depth];
+    sensor_sample_t replay[history_depth];
+    rc_vector_t sample_y;
+    uint64_t samples_dropped;
+    atomic<uint64_t> samples_replayed;
+    atomic<uint64_t> samples_stale;
+    atomic<uint64_t> update_failures;
     rc_kalman_t kf;
+    rc_vector_t wrapped_y;      // y with headings unwrapped about h, for the rc engine
+    // Time of the newest sample in each input slot, -INFINITY before the
+    // first, kept by whichever thread runs the filter. Only the inputs
+    // fresh by their timeouts are fused.
+    vector<double> input_times;
+    vector<int> active_rows;
+    int active_count;
+    vector<uint8_t> bank_active;
+    // The rc engine can't select rows of H, so a step with inputs timed
+    // out hands it a copy of the active rows, sized at startup
+    MeasurementSubset *active_subset;
+    // Sized to the motion model at startup
+    FixedEKFBase *fixed_kf;
+    // One filter per vehicle in bank mode, with the names each publishes to
+    FilterBank *bank;
+    vector<string> bank_axis_vars;
+    vector<string> bank_state_vars;
+    vector<string> bank_p_vars;
+    vector<double> bank_x;
+    vector<double> bank_P;
+    // The worker thread owns the filter and everything it reads while it
+    // runs. The MOOS thread only sees the snapshots it publishes.
+    thread worker;
+    atomic<bool> worker_running;
+    rc_vector_t worker_inputs;
+    TripleBuffer<state_snapshot_t<max_state_count, max_inputs>> published;
+    state_snapshot_t<max_state_count, max_inputs> local_state;
+    vector<uint8_t> state_msg;
+    vector<uint8_t> composite_msg;
+    double last_axis_publish;
     rc_vector_t sensor_inputs;
     rc_matrix_t sensor_estimation_matrix;
     NavState2D *nav_state;
@@ -55,6 +183,7 @@ private: // State variables
     bool data_good;
     bool server_connected;
     bool debug_enabled;
+    rc_matrix_t debug_obsv;     // product of H and every F so far, for EKF_DEBUG_OBSV
 };
 
 #endif
@@ -0,0 +1,123 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: NavEKF_alog.h                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <istream>
+#include <string>
+
+using namespace std;
+
+// One record of a MOOS .alog. The line is
+//
+//   <time> <variable> <source> <value>
+//
+// separated by runs of spaces or tabs, with time in seconds since the
+// log's LOGSTART and the value running to the end of the line.
+struct alog_entry_t {
+    double time;
+    string var;
+    string source;
+    string value;       // raw text of the value
+    double number;      // the value, if numeric
+    bool numeric;
+};
+
+// Reads the records of an .alog one at a time. Header and comment lines
+// (those starting with %) are skipped, apart from picking up LOGSTART.
+// The entry passed to next() is reused, so its strings keep their
+// capacity and a long log is read without an allocation per line.
+class AlogReader
+{
+public:
+    AlogReader(istream &input): in(input), log_start(0), lines(0) {}
+
+    // Fills entry with the next record, or returns false at end of file
+    bool next(alog_entry_t &entry)
+    {
+        while (getline(in, line))
+        {
+            lines++;
+            if (parseLine(line, entry)) return true;
+        }
+        return false;
+    }
+
+    // Absolute time the log's record times count from, or 0 if the log
+    // has no LOGSTART header
+    double getLogStart() const {return log_start;};
+    uint64_t getLineCount() const {return lines;};
+
+    // Parse one line into entry. Returns false for headers, comments,
+    // blank lines and anything too short to be a record.
+    bool parseLine(const string &text, alog_entry_t &entry)
+    {
+        const char *p = text.c_str();
+        const char *end = p + text.size();
+        p = skipSpace(p, end);
+        if ((p == end) || (*p == '%'))
+        {
+            parseHeader(p, end);
+            return false;
+        }
+        char *num_end;
+        entry.time = strtod(p, &num_end);
+        if ((num_end == p) || !isSpace(*num_end)) return false;
+        p = skipSpace(num_end, end);
+        const char *tok = p;
+        p = skipToken(p, end);
+        if (p == tok) return false;
+        entry.var.assign(tok, p - tok);
+        p = skipSpace(p, end);
+        tok = p;
+        p = skipToken(p, end);
+        if (p == tok) return false;
+        entry.source.assign(tok, p - tok);
+        p = skipSpace(p, end);
+        // trailing blanks (and a \r from a log written on Windows) aren't part of the value
+        while ((end > p) && isSpace(end[-1])) end--;
+        entry.value.assign(p, end - p);
+        entry.numeric = false;
+        if (p == end) return true;
+        entry.number = strtod(entry.value.c_str(), &num_end);
+        entry.numeric = (num_end == (entry.value.c_str() + entry.value.size()));
+        return true;
+    }
+
+private:
+    istream &in;
+    string line;
+    double log_start;
+    uint64_t lines;
+
+    static bool isSpace(char c) {return ((c == ' ') || (c == '\t') || (c == '\r'));};
+
+    static const char *skipSpace(const char *p, const char *end)
+    {
+        while ((p < end) && isSpace(*p)) p++;
+        return p;
+    }
+
+    static const char *skipToken(const char *p, const char *end)
+    {
+        while ((p < end) && !isSpace(*p)) p++;
+        return p;
+    }
+
+    // %% LOGSTART <time>
+    void parseHeader(const char *p, const char *end)
+    {
+        while ((p < end) && (*p == '%')) p++;
+        p = skipSpace(p, end);
+        const char *tok = p;
+        p = skipToken(p, end);
+        if (string(tok, p - tok) != "LOGSTART") return;
+        log_start = strtod(skipSpace(p, end), nullptr);
+    }
+};
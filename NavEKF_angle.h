@@ -0,0 +1,32 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: NavEKF_angle.h                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#pragma once
+
+#include <cmath>
+
+using namespace std;
+
+// Headings are carried in degrees, as the compass and GPS report them.
+// The state holds them in [0, 360), and the difference of two headings
+// is the short way round, in [-180, 180), so that 1 less 359 is 2 and
+// not -358. Both take a few operations and work in the filter's own
+// precision.
+
+template <typename T>
+inline T wrapHeading(T deg)
+{
+    T wrapped = deg - (T(360) * floor(deg / T(360)));
+    // rounding can land a tiny negative angle on 360 itself
+    return (wrapped >= T(360)) ? T(0) : wrapped;
+}
+
+template <typename T>
+inline T headingDifference(T deg)
+{
+    return wrapHeading(deg + T(180)) - T(180);
+}
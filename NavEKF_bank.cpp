@@ -0,0 +1,273 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: NavEKF_bank.cpp                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#include "NavEKF_bank.h"
+#include <algorithm>
+
+//---------------------------------------------------------
+// WorkerPool
+
+WorkerPool::WorkerPool(int threads):
+job(nullptr),
+job_count(0),
+generation(0),
+busy(0),
+stopping(false)
+{
+    for (int i = 1; i < threads; i++) workers.push_back(thread(&WorkerPool::worker, this, i));
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    start_cv.notify_all();
+    for (auto &t : workers) t.join();
+}
+
+void WorkerPool::run(int count, const function<void(int)> &fn)
+{
+    if (workers.empty())
+    {
+        for (int i = 0; i < count; i++) fn(i);
+        return;
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        job = &fn;
+        job_count = count;
+        busy = workers.size();
+        generation++;
+    }
+    start_cv.notify_all();
+    runChunk(0, count, fn);
+    unique_lock<mutex> guard(lock);
+    done_cv.wait(guard, [this] {return (busy == 0);});
+    job = nullptr;
+}
+
+void WorkerPool::worker(int id)
+{
+    uint64_t seen = 0;
+    unique_lock<mutex> guard(lock);
+    while (true)
+    {
+        start_cv.wait(guard, [&] {return (stopping || (generation != seen));});
+        if (stopping) return;
+        seen = generation;
+        const function<void(int)> &fn = *job;
+        const int count = job_count;
+        guard.unlock();
+        runChunk(id, count, fn);
+        guard.lock();
+        if (--busy == 0) done_cv.notify_one();
+    }
+}
+
+void WorkerPool::runChunk(int id, int count, const function<void(int)> &fn)
+{
+    const int threads = size();
+    const int end = (count * (id + 1)) / threads;
+    for (int i = (count * id) / threads; i < end; i++) fn(i);
+}
+
+//---------------------------------------------------------
+// FilterBank
+
+// Non-owning views over the bank's per-vehicle slices. They must never
+// be passed to rc_matrix_free() or rc_vector_free().
+static rc_vector_t vectorView(double *d, int len)
+{
+    rc_vector_t v = RC_VECTOR_INITIALIZER;
+    v.len = len;
+    v.d = d;
+    v.initialized = 1;
+    return v;
+}
+
+static rc_matrix_t matrixView(double **rows, int row_count, int cols)
+{
+    rc_matrix_t m = RC_MATRIX_INITIALIZER;
+    m.rows = row_count;
+    m.cols = cols;
+    m.d = rows;
+    m.initialized = 1;
+    return m;
+}
+
+FilterBank::FilterBank():
+n(0),
+m(0),
+count(0),
+H(rc_matrix_empty()),
+h_selection(false),
+pool(nullptr),
+step_y(nullptr),
+step_active(nullptr),
+step_dt(0),
+step_q_scale(1)
+{
+}
+
+FilterBank::~FilterBank()
+{
+    clear();
+}
+
+void FilterBank::clear()
+{
+    for (auto f : filters) delete f;
+    filters.clear();
+    if (pool) delete pool;
+    pool = nullptr;
+    for (auto model : models) delete model;
+    models.clear();
+    rc_matrix_free(&H);
+}
+
+bool FilterBank::init(MotionModel *motion_model, int vehicles, const rc_matrix_t &H_in,
+    const rc_matrix_t &Q, const rc_matrix_t &R, const rc_matrix_t &Pi, int threads)
+{
+    clear();
+    models.push_back(motion_model);
+    n = motion_model->getStateCount();
+    m = H_in.rows;
+    count = vehicles;
+    if ((count < 1) || (H_in.cols != n)) return false;
+    vector<uint8_t> wraps(n);
+    for (int i = 0; i < n; i++) wraps[i] = motion_model->wrapsAxis(i);
+    for (int v = 0; v < count; v++)
+    {
+        filters.push_back(newFixedEKF<max_inputs, cov_real_t>(n));
+        if (!(filters.back() && filters.back()->init(Q, R, Pi))) return false;
+        filters.back()->setSelection(H_in);
+        filters.back()->setWrapAxes(wraps.data());
+    }
+    // y = H*x is a gather when each row of H picks out a single state
+    rc_matrix_duplicate(H_in, &H);
+    h_selection = true;
+    h_index.assign(m, -1);
+    for (int a = 0; a < m; a++)
+    {
+        for (int k = 0; k < n; k++)
+        {
+            if (H.d[a][k] == 0) continue;
+            if ((H.d[a][k] != 1) || (h_index[a] >= 0)) h_selection = false;
+            h_index[a] = k;
+        }
+        if (h_index[a] < 0) h_selection = false;
+    }
+    // Models only write the nonzero entries of F, so it's zeroed just once
+    F.assign(count * n * n, 0);
+    F_rows.resize(count * n);
+    for (int r = 0; r < (count * n); r++) F_rows[r] = &F[r * n];
+    x_pred.assign(count * n, 0);
+    h.assign(count * m, 0);
+    failed.assign(count, 0);
+    rows.assign(count * m, 0);
+    threads = min(threads, count / bank_vehicles_per_thread);
+    if (threads > 1) pool = new WorkerPool(threads);
+    for (int t = 1; t < threads; t++) models.push_back(motion_model->clone());
+    return true;
+}
+
+void FilterBank::setSequential(bool enable)
+{
+    for (auto f : filters) f->setSequential(enable);
+}
+
+bool FilterBank::setFactorized(bool enable)
+{
+    bool ok = true;
+    for (auto f : filters) ok &= f->setFactorized(enable);
+    return ok;
+}
+
+bool FilterBank::setAdaptive(int window, double min_scale, double max_scale)
+{
+    bool ok = true;
+    for (auto f : filters) ok &= f->setAdaptive(window, min_scale, max_scale);
+    return ok;
+}
+
+bool FilterBank::setGate(double threshold, int limit)
+{
+    bool ok = true;
+    for (auto f : filters) ok &= f->setGate(threshold, limit);
+    return ok;
+}
+
+int FilterBank::step(const double *y, double dt, double q_scale, const uint8_t *active)
+{
+    step_y = y;
+    step_active = active;
+    step_dt = dt;
+    step_q_scale = q_scale;
+    if (pool)
+    {
+        // One index per thread, so each takes a contiguous run of
+        // vehicles and predicts them with its own model. Capturing only
+        // this keeps the function small enough to avoid an allocation
+        // per step.
+        pool->run(pool->size(), [this](int t) {
+            const int threads = pool->size();
+            const int end = (count * (t + 1)) / threads;
+            for (int v = (count * t) / threads; v < end; v++) updateVehicle(v, *models[t]);
+        });
+    }
+    else
+    {
+        for (int v = 0; v < count; v++) updateVehicle(v, *models[0]);
+    }
+    int failures = 0;
+    for (int v = 0; v < count; v++) failures += failed[v];
+    return failures;
+}
+
+// Prediction and measurement update for one vehicle. Only touches that
+// vehicle's slices and the given model, so vehicles can run on any
+// thread that has a model of its own.
+void FilterBank::updateVehicle(int v, MotionModel &model)
+{
+    double *xp = &x_pred[v * n];
+    model.predict(filters[v]->getEstimate(), step_dt, xp, &F_rows[v * n]);
+    double *hv = &h[v * m];
+    for (int a = 0; a < m; a++)
+    {
+        if (h_selection)
+        {
+            hv[a] = xp[h_index[a]];
+            continue;
+        }
+        double acc = 0;
+        for (int k = 0; k < n; k++) acc += H.d[a][k] * xp[k];
+        hv[a] = acc;
+    }
+    FixedEKFBase &f = *filters[v];
+    rc_matrix_t F_view = matrixView(&F_rows[v * n], n, n);
+    rc_vector_t x_view = vectorView(xp, n);
+    rc_vector_t y_view = vectorView(const_cast<double *>(step_y + (v * m)), m);
+    rc_vector_t h_view = vectorView(hv, m);
+    int row_count = m;
+    int *vehicle_rows = &rows[v * m];
+    if (step_active)
+    {
+        row_count = 0;
+        for (int a = 0; a < m; a++)
+        {
+            if (step_active[(v * m) + a]) vehicle_rows[row_count++] = a;
+        }
+    }
+    failed[v] = !f.predict(F_view, x_view, step_q_scale);
+    if (!failed[v] && (row_count > 0))
+    {
+        failed[v] = !((row_count == m) ? f.correct(H, y_view, h_view) :
+            f.correct(H, y_view, h_view, vehicle_rows, row_count));
+    }
+}
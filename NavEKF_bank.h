@@ -0,0 +1,113 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: NavEKF_bank.h                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "NavEKF_model.h"
+#include "NavEKF_fixed.h"
+
+extern "C" {
+    #include "roboticscape.h"
+}
+
+using namespace std;
+
+// Fewest vehicles worth handing to another thread; below this the
+// handoff costs more than the updates it saves.
+const int bank_vehicles_per_thread = 8;
+
+// Fixed set of threads that run one function over a range of indices.
+// Each thread, the caller's included, takes a contiguous chunk of the
+// range, and run() returns once every index is done.
+class WorkerPool
+{
+public:
+    // threads is the total including the caller, so 1 starts none
+    WorkerPool(int threads);
+    ~WorkerPool();
+
+    void run(int count, const function<void(int)> &fn);
+    int size() const {return (workers.size() + 1);};
+
+private:
+    vector<thread> workers;
+    mutex lock;
+    condition_variable start_cv;
+    condition_variable done_cv;
+    const function<void(int)> *job;
+    int job_count;
+    uint64_t generation;
+    int busy;
+    bool stopping;
+
+    void worker(int id);
+    void runChunk(int id, int count, const function<void(int)> &fn);
+};
+
+// Filters for several vehicles that share a motion model, inputs and
+// noise. Every vehicle has its own model-sized FixedEKF, which holds its
+// estimate. Each vehicle's whole step, prediction included, only touches
+// its own slices, so the vehicles are spread across a WorkerPool when
+// there are enough of them. A model may keep scratch terms between
+// calls, so every thread predicts with its own clone of the model.
+class FilterBank
+{
+public:
+    FilterBank();
+    ~FilterBank();
+
+    // Takes ownership of model. H, Q, R and Pi are as for FixedEKF::init()
+    // and are shared by every vehicle. threads is the most threads to use.
+    bool init(MotionModel *model, int vehicles, const rc_matrix_t &H, const rc_matrix_t &Q,
+        const rc_matrix_t &R, const rc_matrix_t &Pi, int threads);
+    void setSequential(bool enable);
+    bool setFactorized(bool enable);
+    bool setAdaptive(int window, double min_scale, double max_scale);
+    bool setGate(double threshold, int limit);
+    // Predict every vehicle by dt and fuse its inputs, which are laid out
+    // vehicle by vehicle in y. If active is given, it flags the inputs to
+    // fuse, laid out as y, and a vehicle with none is only predicted.
+    // Returns the number of vehicles whose update failed.
+    int step(const double *y, double dt, double q_scale, const uint8_t *active = nullptr);
+
+    int getVehicleCount() const {return count;};
+    int getStateCount() const {return n;};
+    int getThreadCount() const {return (pool ? pool->size() : 1);};
+    const FixedEKFBase &getFilter(int vehicle) const {return *filters[vehicle];};
+    double getState(int vehicle, int axis) const {return filters[vehicle]->getEstimate()[axis];};
+
+private:
+    vector<MotionModel *> models; // one per thread, the first from init()
+    int n;
+    int m;
+    int count;
+    vector<FixedEKFBase *> filters;
+    rc_matrix_t H;
+    bool h_selection;
+    vector<int> h_index;
+    WorkerPool *pool;
+    // Per vehicle, contiguous so they can be viewed as rc types
+    vector<double> F;
+    vector<double *> F_rows;
+    vector<double> x_pred;
+    vector<double> h;
+    vector<uint8_t> failed;
+    vector<int> rows;           // active rows of each vehicle
+    // Arguments of the step in progress, for the worker threads
+    const double *step_y;
+    const uint8_t *step_active;
+    double step_dt;
+    double step_q_scale;
+
+    void updateVehicle(int v, MotionModel &model);
+    void clear();
+};
@@ -0,0 +1,182 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: NavEKF_buffer.h                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+// One timestamped value for one sensor slot
+struct sensor_sample_t {
+    double time;
+    double value;
+    int slot;
+};
+
+// Single-producer/single-consumer ring of samples. The producer only
+// ever writes head and the consumer only ever writes tail, so the two
+// sides can run on different threads without a lock. One element is
+// kept empty to tell full from empty, so it holds DEPTH - 1 items.
+template <typename T, int DEPTH>
+class SampleRing
+{
+public:
+    SampleRing(): head(0), tail(0) {}
+
+    // Returns false, dropping the item, if the ring is full
+    bool push(const T &item)
+    {
+        uint32_t h = head.load(memory_order_relaxed);
+        uint32_t next = (h + 1) % DEPTH;
+        if (next == tail.load(memory_order_acquire)) return false;
+        buf[h] = item;
+        head.store(next, memory_order_release);
+        return true;
+    }
+
+    // Returns false if the ring is empty
+    bool pop(T &item)
+    {
+        uint32_t t = tail.load(memory_order_relaxed);
+        if (t == head.load(memory_order_acquire)) return false;
+        item = buf[t];
+        tail.store((t + 1) % DEPTH, memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return (head.load(memory_order_acquire) == tail.load(memory_order_acquire));
+    }
+
+    // Only safe when neither side is running
+    void clear()
+    {
+        head.store(0);
+        tail.store(0);
+    }
+
+private:
+    T buf[DEPTH];
+    atomic<uint32_t> head;
+    atomic<uint32_t> tail;
+};
+
+// Filter state after a sample was fused, along with the sample itself
+// so that it can be fused again if an older sample turns up late.
+// N is the most states the snapshot can hold; P is packed n*n, row
+// major, for the n states of the filter that filled it.
+template <int N>
+struct filter_snapshot_t {
+    sensor_sample_t sample;
+    double x[N];
+    double P[N * N];
+};
+
+// Fixed-depth history of filter snapshots, oldest first. When full, a
+// new snapshot replaces the oldest one.
+template <int N, int DEPTH>
+class FilterHistory
+{
+public:
+    FilterHistory(): start(0), count(0) {}
+
+    void clear() {start = 0; count = 0;};
+    int size() const {return count;};
+
+    filter_snapshot_t<N> &push()
+    {
+        if (count < DEPTH)
+        {
+            count++;
+        }
+        else
+        {
+            start = (start + 1) % DEPTH;
+        }
+        return at(count - 1);
+    }
+
+    // 0 is the oldest snapshot
+    filter_snapshot_t<N> &at(int i) {return entries[(start + i) % DEPTH];};
+
+    // Newest snapshot at or before t, or -1 if t predates the history
+    int findBefore(double t)
+    {
+        for (int i = count - 1; i >= 0; i--)
+        {
+            if (at(i).sample.time <= t) return i;
+        }
+        return -1;
+    }
+
+    // Keep only the oldest keep snapshots
+    void truncate(int keep)
+    {
+        if (keep < count) count = (keep < 0) ? 0 : keep;
+    }
+
+private:
+    filter_snapshot_t<N> entries[DEPTH];
+    int start;
+    int count;
+};
+
+// Everything the MOOS side needs from one filter step, for a filter of
+// n <= N states and m <= M inputs. P is packed n*n, row major.
+template <int N, int M>
+struct state_snapshot_t {
+    int n;
+    int m;
+    double time;
+    uint64_t step;
+    double x[N];
+    double x_pre[N];
+    double P[N * N];
+    double noise_scale[M];  // R in use over R configured, per input
+    uint64_t rejected[M];   // samples of each input dropped by the gate
+    uint8_t active[M];      // inputs recent enough to fuse
+};
+
+// Latest-value handoff from one producer thread to one consumer thread.
+// The producer fills back() and calls publish(); the consumer calls
+// update() and reads front(). Three slots mean neither side ever waits
+// or sees a half-written value, and the consumer always gets the newest
+// published value, skipping any it was too slow to see.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer(): back_slot(0), front_slot(1), ready(2) {}
+
+    T &back() {return slots[back_slot];};
+
+    void publish()
+    {
+        back_slot = ready.exchange(back_slot | fresh_bit, memory_order_acq_rel) & slot_mask;
+    }
+
+    // Returns true if front() changed
+    bool update()
+    {
+        if (!(ready.load(memory_order_relaxed) & fresh_bit)) return false;
+        front_slot = ready.exchange(front_slot, memory_order_acq_rel) & slot_mask;
+        return true;
+    }
+
+    const T &front() const {return slots[front_slot];};
+
+private:
+    static const uint8_t fresh_bit = 0x04;
+    static const uint8_t slot_mask = 0x03;
+    T slots[3];
+    uint8_t back_slot;          // producer only
+    uint8_t front_slot;         // consumer only
+    atomic<uint8_t> ready;      // slot index, plus fresh_bit if unread
+};
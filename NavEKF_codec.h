@@ -0,0 +1,122 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: NavEKF_codec.h                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// Binary state message, published as a MOOS binary message. Layout,
+// with every field in host byte order and no padding:
+//
+//   uint32_t magic          nav_state_magic
+//   uint16_t version        nav_state_version
+//   uint8_t  state_count    n
+//   uint8_t  flags          nav_state_flag_t bits
+//   uint64_t step           filter step count
+//   double   time           MOOS time of the estimate
+//   double   x[n]           state estimate
+//   double   P[n*(n+1)/2]   upper triangle of P, row by row, if flagged
+//
+// Consumers should check magic and version before anything else, and
+// use decodeNavState() rather than reading the buffer by hand.
+
+const uint32_t nav_state_magic = 0x46454b4e;   // "NKEF" read as little-endian bytes
+const uint16_t nav_state_version = 1;
+const size_t nav_state_header_size = 24;
+
+enum nav_state_flag_t : uint8_t {
+    has_covariance  = 0x01
+};
+
+// Decoded message. P is filled out to the full symmetric matrix.
+template <int N>
+struct nav_state_packet_t {
+    uint16_t version;
+    uint8_t flags;
+    uint64_t step;
+    double time;
+    double x[N];
+    double P[N][N];
+};
+
+inline size_t navStateMessageSize(int n, bool covariance)
+{
+    size_t len = nav_state_header_size + (n * sizeof(double));
+    if (covariance) len += ((n * (n + 1)) / 2) * sizeof(double);
+    return len;
+}
+
+// Encode into buf, which is only resized when the message size changes,
+// so a buffer kept between calls is not reallocated. P is n*n, row major,
+// or nullptr to leave the covariance out. Returns the message length.
+inline size_t encodeNavState(vector<uint8_t> &buf, double time, uint64_t step,
+    const double *x, const double *P, int n)
+{
+    const uint8_t count = n;
+    const uint8_t flags = P ? nav_state_flag_t::has_covariance : 0;
+    const size_t len = navStateMessageSize(n, (P != nullptr));
+    if (buf.size() != len) buf.resize(len);
+    uint8_t *out = buf.data();
+    memcpy(out, &nav_state_magic, 4);
+    memcpy(out + 4, &nav_state_version, 2);
+    memcpy(out + 6, &count, 1);
+    memcpy(out + 7, &flags, 1);
+    memcpy(out + 8, &step, 8);
+    memcpy(out + 16, &time, 8);
+    out += nav_state_header_size;
+    memcpy(out, x, n * sizeof(double));
+    out += n * sizeof(double);
+    if (!P) return len;
+    for (int i = 0; i < n; i++)
+    {
+        memcpy(out, P + (i * n) + i, (n - i) * sizeof(double));
+        out += (n - i) * sizeof(double);
+    }
+    return len;
+}
+
+// Returns false if the buffer isn't a complete message of this version
+// with N states. The covariance is zeroed if the message doesn't carry it.
+template <int N>
+bool decodeNavState(const uint8_t *data, size_t len, nav_state_packet_t<N> &packet)
+{
+    uint32_t magic;
+    uint8_t count;
+    if (len < nav_state_header_size) return false;
+    memcpy(&magic, data, 4);
+    memcpy(&packet.version, data + 4, 2);
+    memcpy(&count, data + 6, 1);
+    memcpy(&packet.flags, data + 7, 1);
+    if ((magic != nav_state_magic) || (packet.version != nav_state_version)) return false;
+    if (count != N) return false;
+    const bool covariance = (packet.flags & nav_state_flag_t::has_covariance);
+    if (len != navStateMessageSize(N, covariance)) return false;
+    memcpy(&packet.step, data + 8, 8);
+    memcpy(&packet.time, data + 16, 8);
+    const uint8_t *in = data + nav_state_header_size;
+    memcpy(packet.x, in, N * sizeof(double));
+    in += N * sizeof(double);
+    for (int i = 0; i < N; i++)
+    {
+        for (int j = i; j < N; j++)
+        {
+            double p = 0;
+            if (covariance)
+            {
+                memcpy(&p, in, sizeof(double));
+                in += sizeof(double);
+            }
+            packet.P[i][j] = p;
+            packet.P[j][i] = p;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,1041 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: NavEKF_fixed.h                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include "NavEKF_simd.h"
+#include "NavEKF_angle.h"
+
+extern "C" {
+    #include "roboticscape.h"
+}
+
+using namespace std;
+
+// Precision of the covariance and gain arithmetic in NavEKF's fixed engine
+#ifdef NAVEKF_FLOAT_COVARIANCE
+typedef float cov_real_t;
+#else
+typedef double cov_real_t;
+#endif
+
+// Largest number of INPUT lines NavEKF's fixed-size engine is built for
+const int max_inputs = 16;
+// Longest innovation window the adaptive measurement noise can average
+const int adaptive_depth = 64;
+
+// Run-time sized face of FixedEKF, for holding a filter whose state
+// dimension is set by the motion model picked at startup. The filter
+// behind it keeps its fixed-size storage and loops; only these calls go
+// through the vtable. Covariances cross it as n*n arrays, row major.
+class FixedEKFBase
+{
+public:
+    virtual ~FixedEKFBase() {}
+    virtual int getStateCount() const = 0;
+    virtual bool init(const rc_matrix_t &Q_in, const rc_matrix_t &R_in, const rc_matrix_t &P_in) = 0;
+    virtual void reset() = 0;
+    virtual bool predict(const rc_matrix_t &F, const rc_vector_t &x_predict, double q_scale = 1) = 0;
+    virtual bool correct(const rc_matrix_t &H, const rc_vector_t &y, const rc_vector_t &h) = 0;
+    virtual bool correct(const rc_matrix_t &H, const rc_vector_t &y, const rc_vector_t &h,
+        const int *rows, int row_count) = 0;
+    virtual void setSequential(bool enable) = 0;
+    virtual bool setFactorized(bool enable) = 0;
+    virtual bool setSelection(const rc_matrix_t &H) = 0;
+    virtual void setWrapAxes(const uint8_t *wraps) = 0;
+    virtual bool setAdaptive(int window, double min_scale, double max_scale) = 0;
+    virtual double getNoiseScale(int row) const = 0;
+    virtual bool setGate(double threshold, int limit) = 0;
+    virtual uint64_t getRejectCount(int row) const = 0;
+    virtual void setReplaying(bool enable) = 0;
+    virtual void setState(const double *x, const double *P_in) = 0;
+    virtual void getCovariance(double *P_out) const = 0;
+    virtual const double *getEstimate() const = 0;
+    virtual const double *getPrediction() const = 0;
+    virtual uint64_t getStep() const = 0;
+    virtual rc_vector_t estimateVector() = 0;
+};
+
+// Extended Kalman filter with all storage sized at compile time.
+// N is the state dimension and M is the largest number of measurements
+// the filter will be asked to fuse; the number actually in use is set
+// by the size of R at init() time. Nothing in here touches the heap, so
+// update() has a fixed cost and no allocator jitter.
+//
+// The rc_matrix_t/rc_vector_t arguments are read in place and never
+// resized, so the filter can be fed directly from NavState2D.
+//
+// update() is predict() followed by correct() over every measurement.
+// The row-selecting correct() fuses only the listed measurements (rows
+// of H, y and h, and the matching block of R), which lets the caller
+// fuse each sensor as it reports.
+//
+// init() notes whether R is diagonal, as it is when each input has its
+// own independent noise. With setSequential(true) and a diagonal R,
+// correct() fuses one measurement at a time as a scalar update. That
+// needs no factorization of S and costs O(m*N^2) rather than
+// O(m^3 + m*N^2), and for a linear H it gives the same answer as the
+// joint update. The joint update adds only the diagonal of a diagonal R.
+//
+// When H only selects states (each row a single 1), setSelection() swaps
+// the dense products with H for gathers from P and x by index. The dense
+// path remains for any other H.
+//
+// setWrapAxes() marks the states that are headings in degrees. The
+// innovation of a row of a selection H that reads one is taken the
+// short way round, so a heading crossing north moves the estimate by a
+// few degrees rather than most of a turn, and those states are put back
+// in [0, 360) after each correction.
+//
+// setFactorized(true) carries the covariance as P = U*D*U^T, with U unit
+// upper triangular and D diagonal, in place of P itself. Prediction is
+// Thornton's modified weighted Gram-Schmidt update and correction is
+// Bierman's scalar update, so P stays symmetric and positive definite by
+// construction and never needs symmetrizing. P is rebuilt from U and D
+// after each step for anything that reads it. This needs a diagonal R.
+//
+// setAdaptive() estimates each input's noise from its own innovations,
+// so that a sensor whose quality drops, such as GPS under a bridge or in
+// multipath, is trusted less while it lasts. Every fused innovation v
+// gives a sample v^2 - h*P*h^T of that input's variance. The samples
+// are kept in a ring per input, with a running sum, so the estimate over
+// the last window samples costs O(1) per measurement. Once the window
+// has filled, the estimate replaces the input's entry of R, held between
+// min_scale and max_scale times the configured variance. This needs a
+// diagonal R.
+//
+// setGate() tests each measurement before it is fused, and drops it if
+// its squared Mahalanobis distance v^2 / (h*P*h^T + r) is over the
+// threshold, a chi-square value with one degree of freedom (9 for three
+// sigma). A single wild fix then costs one missed measurement rather
+// than many steps of bad estimates. The scalar updates have the terms
+// to hand already; the joint update tests each row against its own
+// diagonal of S and solves for the rows left. The estimated R is updated
+// before the test, so a sensor that has truly got noisier is let back in.
+// So that the gate can't lock an input out, e.g. before the estimate has
+// converged from its zero start or after a long outage, the first limit
+// measurements of each input are fused untested, and so are the next
+// limit after limit rejections in a row.
+//
+// setReplaying(true) marks the measurements that follow as ones already
+// fused once, being fused again after a rewind to take in a late sample.
+// They are gated as usual, but add nothing to the innovation windows or
+// the gate's counts, so that no measurement is counted twice.
+//
+// T is the precision of the covariance and gain arithmetic. The state
+// estimate itself is always double, since single precision can't hold
+// large local coordinates to better than a few millimetres.
+//
+// P, Q and the prediction scratch are stored in rows of NP, N rounded up
+// to whole SIMD registers, with the padding held at zero. The covariance
+// prediction and the P updates in correct() run as whole-row kernels
+// from NavEKF_simd.h over that layout.
+template <int N, int M, typename T = double>
+class FixedEKF final : public FixedEKFBase
+{
+public:
+    FixedEKF();
+
+    bool init(const rc_matrix_t &Q_in, const rc_matrix_t &R_in, const rc_matrix_t &P_in);
+    void reset();
+    bool update(const rc_matrix_t &F, const rc_matrix_t &H, const rc_vector_t &x_predict,
+        const rc_vector_t &y, const rc_vector_t &h);
+    bool predict(const rc_matrix_t &F, const rc_vector_t &x_predict, double q_scale = 1);
+    bool correct(const rc_matrix_t &H, const rc_vector_t &y, const rc_vector_t &h);
+    bool correct(const rc_matrix_t &H, const rc_vector_t &y, const rc_vector_t &h,
+        const int *rows, int row_count);
+    int getMeasCount() const {return meas_count;};
+    void setSequential(bool enable) {sequential = enable;};
+    bool setFactorized(bool enable);
+    bool isFactorized() const {return factorized;};
+    void setState(const double *x, const double (*P_in)[N]);
+    void setState(const double *x, const double *P_in) {setState(x, (const double (*)[N])P_in);};
+    void getCovariance(double (*P_out)[N]) const;
+    void getCovariance(double *P_out) const {getCovariance((double (*)[N])P_out);};
+    int getStateCount() const {return N;};
+    const double *getEstimate() const {return x_est;};
+    const double *getPrediction() const {return x_pre;};
+    uint64_t getStep() const {return step;};
+    bool setSelection(const rc_matrix_t &H);
+    void clearSelection() {h_selection = false;};
+    bool isSelection() const {return h_selection;};
+    // wraps[i] nonzero for each heading state; nullptr for none
+    void setWrapAxes(const uint8_t *wraps);
+    static bool selectionIndex(const rc_matrix_t &H, int *index);
+    bool isSequential() const {return (sequential && r_diagonal);};
+    bool isDiagonalR() const {return r_diagonal;};
+    bool setAdaptive(int window, double min_scale = 1, double max_scale = 100);
+    bool isAdaptive() const {return (adapt_window > 0);};
+    // R in use for a measurement, relative to the R it was set up with
+    double getNoiseScale(int row) const {return (R[row][row] / R_base[row]);};
+    bool setGate(double threshold, int limit = 10);
+    double getGate() const {return gate;};
+    // Measurements of a row dropped by the gate since init()
+    uint64_t getRejectCount(int row) const {return rejected[row];};
+    void setReplaying(bool enable) {replaying = enable;};
+    rc_vector_t estimateVector();
+    static constexpr int getStateDim() {return N;};
+    static constexpr int getMaxMeas() {return M;};
+
+    // Padded row length of P, Q and the prediction scratch
+    static constexpr int NP = simdWidth<T>(N);
+
+    // Public to mirror rc_kalman_t
+    double x_est[N];
+    double x_pre[N];
+    alignas(16) T P[N][NP];
+    T Pi[N][N];
+    alignas(16) T Q[N][NP];
+    T R[M][M];
+    // U*D*U^T factors of P when factorized
+    T U[N][N];
+    T D[N];
+    uint64_t step;
+
+private:
+    int meas_count;
+    int all_rows[M];
+    bool sequential;
+    bool r_diagonal;
+    bool h_selection;
+    int h_index[M];     // state selected by each row of H when h_selection
+    bool state_wrap[N]; // headings, kept in [0, 360)
+    bool row_wrap[M];   // rows whose innovation wraps, from h_index
+    bool any_wrap;
+    bool factorized;
+    // Windows of innovation-based variance samples, when adaptive
+    int adapt_window;   // 0 when off
+    T adapt_min;
+    T adapt_max;
+    T R_base[M];
+    T adapt_ring[M][adaptive_depth];
+    T adapt_sum[M];
+    int adapt_head[M];
+    int adapt_count[M];
+    T gate;             // 0 when off
+    int gate_limit;
+    int gate_free[M];   // measurements to fuse before testing again
+    int gate_run[M];    // rejections in a row
+    uint64_t rejected[M];
+    bool replaying;     // fusing measurements that have been counted already
+    // U*D*U^T factors of Q for the Thornton update
+    T Uq[N][N];
+    T Dq[N];
+    // Scratch space for update()
+    alignas(16) T Fw[N][NP];
+    alignas(16) T FP[N][NP];
+    alignas(16) T Ft[N][NP];
+    alignas(16) T HP[M][NP];
+    alignas(16) T ph[NP];
+    T PHt[N][M];
+    T S[M][M];
+    T L[N][M];
+    T z[M];
+    T dx[N];
+    T W[N][N];
+    T G[N][N];
+    T Dw[N];
+    T Dqw[N];
+    T f[N];
+    T b[N];
+
+    bool correctJoint(const rc_matrix_t &H, const rc_vector_t &y, const rc_vector_t &h,
+        const int *rows, int m);
+    bool correctSequential(const rc_matrix_t &H, const rc_vector_t &y, const rc_vector_t &h,
+        const int *rows, int m);
+    void adaptNoise(int row, T innovation, T hph);
+    void clearAdaptive();
+    bool gateRejects(int row, T innovation, T s);
+    void indexWrapRows();
+    bool predictUD(double q_scale);
+    bool correctBierman(const rc_matrix_t &H, const rc_vector_t &y, const rc_vector_t &h,
+        const int *rows, int m);
+    static bool factorUD(const T (*A)[NP], T (*U_out)[N], T *D_out);
+    void composeP();
+    bool choleskyInPlace(int m);
+    void symmetrize();
+};
+
+// A FixedEKF sized for an n-state model, or nullptr if none is built
+// for n. Every model in the registry needs its dimension listed here.
+template <int M, typename T>
+FixedEKFBase *newFixedEKF(int n)
+{
+    switch (n)
+    {
+        case 4: return new FixedEKF<4, M, T>();
+        case 5: return new FixedEKF<5, M, T>();
+        case 6: return new FixedEKF<6, M, T>();
+        case 8: return new FixedEKF<8, M, T>();
+    }
+    return nullptr;
+}
+
+template <int N, int M, typename T>
+FixedEKF<N, M, T>::FixedEKF():
+step(0),
+meas_count(0),
+sequential(false),
+r_diagonal(true),
+h_selection(false),
+any_wrap(false),
+factorized(false),
+adapt_window(0),
+adapt_min(1),
+adapt_max(1),
+gate(0),
+gate_limit(0),
+replaying(false)
+{
+    for (int i = 0; i < M; i++) all_rows[i] = i;
+    // Zeroing the full padded rows here is what keeps the padding zero;
+    // everything after only writes the first N columns, or whole rows
+    // built from other zero-padded rows.
+    for (int i = 0; i < N; i++)
+    {
+        for (int j = 0; j < N; j++) Pi[i][j] = (i == j) ? 1 : 0;
+        for (int j = 0; j < NP; j++)
+        {
+            P[i][j] = 0;
+            Q[i][j] = 0;
+            Fw[i][j] = 0;
+            FP[i][j] = 0;
+            Ft[i][j] = 0;
+        }
+    }
+    for (int i = 0; i < M; i++)
+    {
+        for (int j = 0; j < M; j++) R[i][j] = 0;
+        for (int j = 0; j < NP; j++) HP[i][j] = 0;
+        R_base[i] = 1;
+        rejected[i] = 0;
+        row_wrap[i] = false;
+    }
+    for (int i = 0; i < N; i++) state_wrap[i] = false;
+    for (int j = 0; j < NP; j++) ph[j] = 0;
+    reset();
+}
+
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::init(const rc_matrix_t &Q_in, const rc_matrix_t &R_in, const rc_matrix_t &P_in)
+{
+    if ((Q_in.rows != N) || (Q_in.cols != N)) return false;
+    if ((P_in.rows != N) || (P_in.cols != N)) return false;
+    if ((R_in.rows != R_in.cols) || (R_in.rows > M) || (R_in.rows < 1)) return false;
+    meas_count = R_in.rows;
+    for (int i = 0; i < N; i++)
+    {
+        for (int j = 0; j < N; j++)
+        {
+            Q[i][j] = Q_in.d[i][j];
+            Pi[i][j] = P_in.d[i][j];
+        }
+    }
+    r_diagonal = true;
+    for (int i = 0; i < meas_count; i++)
+    {
+        for (int j = 0; j < meas_count; j++)
+        {
+            R[i][j] = R_in.d[i][j];
+            if ((i != j) && (R[i][j] != 0)) r_diagonal = false;
+        }
+        R_base[i] = R[i][i];
+    }
+    if (!r_diagonal) adapt_window = 0;
+    for (int i = 0; i < M; i++) rejected[i] = 0;
+    reset();
+    return true;
+}
+
+// Non-owning rc_vector_t over x_est, for handing the estimate to
+// NavState2D::tick(). It must never be passed to rc_vector_free().
+template <int N, int M, typename T>
+rc_vector_t FixedEKF<N, M, T>::estimateVector()
+{
+    rc_vector_t v = RC_VECTOR_INITIALIZER;
+    v.len = N;
+    v.d = x_est;
+    v.initialized = 1;
+    return v;
+}
+
+template <int N, int M, typename T>
+void FixedEKF<N, M, T>::reset()
+{
+    for (int i = 0; i < N; i++)
+    {
+        x_est[i] = 0;
+        x_pre[i] = 0;
+        for (int j = 0; j < N; j++) P[i][j] = Pi[i][j];
+    }
+    step = 0;
+    if (factorized) factorUD(P, U, D);
+    clearAdaptive();
+    for (int a = 0; a < M; a++)
+    {
+        gate_free[a] = gate_limit;
+        gate_run[a] = 0;
+    }
+}
+
+// Estimate R from the last window innovations of each input, keeping it
+// within min_scale to max_scale of the configured R. A window of 0 turns
+// this off. Fails if R isn't diagonal or the settings are out of range.
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::setAdaptive(int window, double min_scale, double max_scale)
+{
+    if ((window < 0) || (window > adaptive_depth)) return false;
+    if ((window > 0) && !(r_diagonal && (min_scale > 0) && (max_scale >= min_scale))) return false;
+    adapt_window = window;
+    adapt_min = min_scale;
+    adapt_max = max_scale;
+    clearAdaptive();
+    return true;
+}
+
+// Drop measurements further than threshold, as v^2/s, from the
+// prediction, other than those fused to let an input back in after
+// limit rejections. 0 turns the gate off.
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::setGate(double threshold, int limit)
+{
+    if (!((threshold >= 0) && (limit >= 0))) return false;
+    gate = threshold;
+    gate_limit = limit;
+    for (int a = 0; a < M; a++)
+    {
+        gate_free[a] = gate_limit;
+        gate_run[a] = 0;
+    }
+    return true;
+}
+
+// True, counting it unless replaying, if the measurement of row with this
+// innovation and innovation variance s is to be dropped
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::gateRejects(int row, T innovation, T s)
+{
+    const bool pass = (gate_free[row] > 0) || !((innovation * innovation) > (gate * s));
+    if (replaying) return !pass;
+    if (pass)
+    {
+        if (gate_free[row] > 0) gate_free[row]--;
+        gate_run[row] = 0;
+        return false;
+    }
+    rejected[row]++;
+    if (++gate_run[row] >= gate_limit)
+    {
+        gate_free[row] = gate_limit;
+        gate_run[row] = 0;
+    }
+    return true;
+}
+
+// Empty every window and go back to the configured R
+template <int N, int M, typename T>
+void FixedEKF<N, M, T>::clearAdaptive()
+{
+    for (int a = 0; a < M; a++)
+    {
+        if (r_diagonal) R[a][a] = R_base[a];
+        for (int k = 0; k < adaptive_depth; k++) adapt_ring[a][k] = 0;
+        adapt_sum[a] = 0;
+        adapt_head[a] = 0;
+        adapt_count[a] = 0;
+    }
+}
+
+// Add the variance sample of one innovation, taken against h*P*h^T from
+// the P it is about to be fused into, to the row's window and set its R
+template <int N, int M, typename T>
+void FixedEKF<N, M, T>::adaptNoise(int row, T innovation, T hph)
+{
+    if (replaying) return;
+    T *ring = adapt_ring[row];
+    const T sample = (innovation * innovation) - hph;
+    adapt_sum[row] += sample - ring[adapt_head[row]];
+    ring[adapt_head[row]] = sample;
+    if (++adapt_head[row] == adapt_window)
+    {
+        // Sum afresh once per lap so rounding can't build up in the
+        // running sum over a long mission
+        adapt_head[row] = 0;
+        T sum = 0;
+        for (int k = 0; k < adapt_window; k++) sum += ring[k];
+        adapt_sum[row] = sum;
+    }
+    if (adapt_count[row] < adapt_window) adapt_count[row]++;
+    if (adapt_count[row] < adapt_window) return;
+    const T estimate = adapt_sum[row] / adapt_window;
+    R[row][row] = min(max(estimate, adapt_min * R_base[row]), adapt_max * R_base[row]);
+}
+
+// Switch to carrying P as U*D*U^T. Fails, leaving the filter as it was,
+// if R isn't diagonal or P or Q can't be factored.
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::setFactorized(bool enable)
+{
+    if (!enable)
+    {
+        factorized = false;
+        return true;
+    }
+    if (!r_diagonal) return false;
+    if (!factorUD(Q, Uq, Dq)) return false;
+    if (!factorUD(P, U, D)) return false;
+    factorized = true;
+    return true;
+}
+
+// Overwrite the estimate and covariance, e.g. to rewind to a snapshot
+template <int N, int M, typename T>
+void FixedEKF<N, M, T>::setState(const double *x, const double (*P_in)[N])
+{
+    for (int i = 0; i < N; i++)
+    {
+        x_est[i] = x[i];
+        for (int j = 0; j < N; j++) P[i][j] = P_in[i][j];
+    }
+    if (factorized) factorUD(P, U, D);
+}
+
+// Copy of P in double, whatever precision the filter runs in
+template <int N, int M, typename T>
+void FixedEKF<N, M, T>::getCovariance(double (*P_out)[N]) const
+{
+    for (int i = 0; i < N; i++)
+    {
+        for (int j = 0; j < N; j++) P_out[i][j] = P[i][j];
+    }
+}
+
+// Returns true, filling index with the state picked by each row, if
+// every row of H is all zeros but for a single 1.
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::selectionIndex(const rc_matrix_t &H, int *index)
+{
+    for (int a = 0; a < H.rows; a++)
+    {
+        index[a] = -1;
+        for (int k = 0; k < H.cols; k++)
+        {
+            if (H.d[a][k] == 0) continue;
+            if ((H.d[a][k] != 1) || (index[a] >= 0)) return false;
+            index[a] = k;
+        }
+        if (index[a] < 0) return false;
+    }
+    return true;
+}
+
+// Use the gather path for H from now on, if H is a selection matrix
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::setSelection(const rc_matrix_t &H)
+{
+    h_selection = false;
+    if ((H.rows != meas_count) || (H.cols != N)) return false;
+    h_selection = selectionIndex(H, h_index);
+    indexWrapRows();
+    return h_selection;
+}
+
+template <int N, int M, typename T>
+void FixedEKF<N, M, T>::setWrapAxes(const uint8_t *wraps)
+{
+    any_wrap = false;
+    for (int i = 0; i < N; i++)
+    {
+        state_wrap[i] = (wraps && wraps[i]);
+        any_wrap = any_wrap || state_wrap[i];
+    }
+    indexWrapRows();
+}
+
+// Only a row that selects a heading can be wrapped; a general row of H
+// mixes states, and its innovation is left as it is
+template <int N, int M, typename T>
+void FixedEKF<N, M, T>::indexWrapRows()
+{
+    for (int a = 0; a < M; a++)
+    {
+        row_wrap[a] = h_selection && (a < meas_count) && state_wrap[h_index[a]];
+    }
+}
+
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::update(
+    const rc_matrix_t &F,
+    const rc_matrix_t &H,
+    const rc_vector_t &x_predict,
+    const rc_vector_t &y,
+    const rc_vector_t &h
+) {
+    if (!predict(F, x_predict)) return false;
+    return correct(H, y, h);
+}
+
+// P[k|k-1] = F*P[k-1|k-1]*F^T + q_scale*Q
+// x_est is set to the prediction so that correct() can refine it in place,
+// with any heading wrapped; x_pre keeps the model's own value.
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::predict(const rc_matrix_t &F, const rc_vector_t &x_predict, double q_scale)
+{
+    if ((F.rows != N) || (F.cols != N) || (x_predict.len != N)) return false;
+
+    for (int i = 0; i < N; i++)
+    {
+        x_pre[i] = x_predict.d[i];
+        x_est[i] = (any_wrap && state_wrap[i]) ? wrapHeading(x_predict.d[i]) : x_predict.d[i];
+    }
+    // Work from a copy of F in the filter's own precision
+    for (int i = 0; i < N; i++)
+    {
+        for (int j = 0; j < N; j++) Fw[i][j] = F.d[i][j];
+    }
+    if (factorized) return predictUD(q_scale);
+    propagateCovariance<N, NP, T>(Fw, P, Q, T(q_scale), FP, Ft, P);
+    symmetrize();
+    return true;
+}
+
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::correct(const rc_matrix_t &H, const rc_vector_t &y, const rc_vector_t &h)
+{
+    return correct(H, y, h, all_rows, meas_count);
+}
+
+// Fuse the measurements listed in rows[] into x_est and P.
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::correct(
+    const rc_matrix_t &H,
+    const rc_vector_t &y,
+    const rc_vector_t &h,
+    const int *rows,
+    int row_count
+) {
+    const int m = row_count;
+    if ((H.rows != meas_count) || (H.cols != N)) return false;
+    if ((y.len != meas_count) || (h.len != meas_count)) return false;
+    if ((m < 1) || (m > meas_count)) return false;
+    bool ok;
+    if (factorized) ok = correctBierman(H, y, h, rows, m);
+    else if (sequential && r_diagonal) ok = correctSequential(H, y, h, rows, m);
+    else ok = correctJoint(H, y, h, rows, m);
+    if (any_wrap)
+    {
+        for (int i = 0; i < N; i++)
+        {
+            if (state_wrap[i]) x_est[i] = wrapHeading(x_est[i]);
+        }
+    }
+    return ok;
+}
+
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::correctJoint(
+    const rc_matrix_t &H,
+    const rc_vector_t &y,
+    const rc_vector_t &h,
+    const int *rows,
+    int m
+) {
+    // H*P a padded row at a time, kept for the rank-m update of P below.
+    // P*H^T is its transpose, since P is symmetric.
+    if (h_selection)
+    {
+        // Each row of H*P is a row of P, and H*P*H^T a gather from those
+        for (int a = 0; a < m; a++)
+        {
+            const T *src = P[h_index[rows[a]]];
+            for (int j = 0; j < NP; j++) HP[a][j] = src[j];
+        }
+        for (int i = 0; i < N; i++)
+        {
+            for (int a = 0; a < m; a++) PHt[i][a] = HP[a][i];
+        }
+        for (int a = 0; a < m; a++)
+        {
+            for (int b = 0; b < m; b++) S[a][b] = PHt[h_index[rows[a]]][b];
+        }
+    }
+    else
+    {
+        for (int a = 0; a < m; a++)
+        {
+            const double *h_row = H.d[rows[a]];
+            simdScale<NP>(HP[a], T(h_row[0]), P[0]);
+            for (int k = 1; k < N; k++) simdAxpy<NP>(HP[a], T(h_row[k]), P[k]);
+        }
+        for (int i = 0; i < N; i++)
+        {
+            for (int a = 0; a < m; a++) PHt[i][a] = HP[a][i];
+        }
+        for (int a = 0; a < m; a++)
+        {
+            for (int b = 0; b < m; b++)
+            {
+                T acc = 0;
+                for (int k = 0; k < N; k++) acc += H.d[rows[a]][k] * PHt[k][b];
+                S[a][b] = acc;
+            }
+        }
+    }
+    // x[k|k] = x[k|k-1] + L[k]*(y[k]-h[k]), applied below
+    for (int a = 0; a < m; a++)
+    {
+        z[a] = y.d[rows[a]] - h.d[rows[a]];
+        if (row_wrap[rows[a]]) z[a] = headingDifference(z[a]);
+    }
+    if (adapt_window > 0)
+    {
+        for (int a = 0; a < m; a++) adaptNoise(rows[a], z[a], S[a][a]);
+    }
+    // S = H*P*H^T + R, touching only the diagonal when that's all R has
+    if (r_diagonal)
+    {
+        for (int a = 0; a < m; a++) S[a][a] += R[rows[a]][rows[a]];
+    }
+    else
+    {
+        for (int a = 0; a < m; a++)
+        {
+            for (int b = 0; b < m; b++) S[a][b] += R[rows[a]][rows[b]];
+        }
+    }
+    if (gate > 0)
+    {
+        // Keep the rows that pass, closing up HP, PHt, S and z over the
+        // ones that don't. Every kept row moves to an index no later
+        // than its own, so this is safe in place.
+        int keep[M];
+        int kept = 0;
+        for (int a = 0; a < m; a++)
+        {
+            if (!gateRejects(rows[a], z[a], S[a][a])) keep[kept++] = a;
+        }
+        if (kept == 0)
+        {
+            step++;
+            return true;
+        }
+        if (kept < m)
+        {
+            for (int k = 0; k < kept; k++)
+            {
+                const int a = keep[k];
+                for (int l = 0; l < kept; l++) S[k][l] = S[a][keep[l]];
+                for (int j = 0; j < NP; j++) HP[k][j] = HP[a][j];
+                for (int i = 0; i < N; i++) PHt[i][k] = PHt[i][a];
+                z[k] = z[a];
+            }
+            m = kept;
+        }
+    }
+
+    // L = P*H^T*S^-1, solved row by row against the Cholesky factor of S
+    // rather than forming the inverse.
+    if (!choleskyInPlace(m))
+    {
+        step++;
+        return false;
+    }
+    for (int i = 0; i < N; i++)
+    {
+        // forward substitution: C*w = PHt[i]
+        for (int a = 0; a < m; a++)
+        {
+            T acc = PHt[i][a];
+            for (int b = 0; b < a; b++) acc -= S[a][b] * L[i][b];
+            L[i][a] = acc / S[a][a];
+        }
+        // back substitution: C^T*l = w
+        for (int a = m - 1; a >= 0; a--)
+        {
+            T acc = L[i][a];
+            for (int b = a + 1; b < m; b++) acc -= S[b][a] * L[i][b];
+            L[i][a] = acc / S[a][a];
+        }
+    }
+
+    for (int i = 0; i < N; i++)
+    {
+        T acc = 0;
+        for (int a = 0; a < m; a++) acc += L[i][a] * z[a];
+        x_est[i] += acc;
+    }
+
+    // P[k|k] = P - L*H*P, as a sum of scaled rows of H*P
+    for (int i = 0; i < N; i++)
+    {
+        for (int a = 0; a < m; a++) simdAxpy<NP>(P[i], -L[i][a], HP[a]);
+    }
+    symmetrize();
+    step++;
+    return true;
+}
+
+// One scalar update per row. h was evaluated at the prior, so each
+// innovation is corrected by H*dx for the updates already applied.
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::correctSequential(
+    const rc_matrix_t &H,
+    const rc_vector_t &y,
+    const rc_vector_t &h,
+    const int *rows,
+    int m
+) {
+    bool ok = true;
+    for (int i = 0; i < N; i++) dx[i] = 0;
+    for (int a = 0; a < m; a++)
+    {
+        // ph = P*h_row^T, built from rows of P since P is symmetric
+        T s = 0;
+        T innovation = y.d[rows[a]] - h.d[rows[a]];
+        if (h_selection)
+        {
+            const int k = h_index[rows[a]];
+            for (int j = 0; j < NP; j++) ph[j] = P[k][j];
+            s += P[k][k];
+            innovation -= dx[k];
+        }
+        else
+        {
+            const double *h_row = H.d[rows[a]];
+            simdScale<NP>(ph, T(h_row[0]), P[0]);
+            for (int k = 1; k < N; k++) simdAxpy<NP>(ph, T(h_row[k]), P[k]);
+            for (int i = 0; i < N; i++)
+            {
+                s += h_row[i] * ph[i];
+                innovation -= h_row[i] * dx[i];
+            }
+        }
+        if (row_wrap[rows[a]]) innovation = headingDifference(innovation);
+        if (adapt_window > 0) adaptNoise(rows[a], innovation, s);
+        s += R[rows[a]][rows[a]];
+        if (!(s > 0))
+        {
+            ok = false;
+            continue;
+        }
+        if ((gate > 0) && gateRejects(rows[a], innovation, s)) continue;
+        // Rank-1 update P -= ph*ph^T/s, a row at a time
+        for (int i = 0; i < N; i++)
+        {
+            T gain = ph[i] / s;
+            x_est[i] += gain * innovation;
+            dx[i] += gain * innovation;
+            simdAxpy<NP>(P[i], -gain, ph);
+        }
+    }
+    symmetrize();
+    step++;
+    return ok;
+}
+
+// Thornton's MWGS time update. The rows of [F*U | Uq] are orthogonalized
+// against the weights diag(D, q_scale*Dq), from the last row up, giving
+// the U and D of F*P*F^T + q_scale*Q directly.
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::predictUD(double q_scale)
+{
+    for (int i = 0; i < N; i++)
+    {
+        for (int j = 0; j < N; j++)
+        {
+            // U is upper triangular, so only k <= j contributes to F*U
+            T acc = 0;
+            for (int k = 0; k <= j; k++) acc += Fw[i][k] * U[k][j];
+            W[i][j] = acc;
+            G[i][j] = Uq[i][j];
+        }
+        Dw[i] = D[i];
+        Dqw[i] = T(q_scale) * Dq[i];
+    }
+    bool ok = true;
+    for (int i = N - 1; i >= 0; i--)
+    {
+        T sigma = 0;
+        for (int k = 0; k < N; k++) sigma += (W[i][k] * W[i][k] * Dw[k]) + (G[i][k] * G[i][k] * Dqw[k]);
+        D[i] = sigma;
+        U[i][i] = 1;
+        if (!(sigma > 0))
+        {
+            ok = false;
+            continue;
+        }
+        for (int j = 0; j < i; j++)
+        {
+            T acc = 0;
+            for (int k = 0; k < N; k++) acc += (W[i][k] * Dw[k] * W[j][k]) + (G[i][k] * Dqw[k] * G[j][k]);
+            T u = acc / sigma;
+            U[j][i] = u;
+            for (int k = 0; k < N; k++)
+            {
+                W[j][k] -= u * W[i][k];
+                G[j][k] -= u * G[i][k];
+            }
+        }
+        for (int j = i + 1; j < N; j++) U[j][i] = 0;
+    }
+    composeP();
+    return ok;
+}
+
+// Bierman's scalar measurement update, once per row. As in the
+// sequential update, each innovation is corrected by H*dx for the rows
+// already fused.
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::correctBierman(
+    const rc_matrix_t &H,
+    const rc_vector_t &y,
+    const rc_vector_t &h,
+    const int *rows,
+    int m
+) {
+    bool ok = true;
+    for (int i = 0; i < N; i++) dx[i] = 0;
+    for (int a = 0; a < m; a++)
+    {
+        // f = U^T*h_row, b = D*f
+        T innovation = y.d[rows[a]] - h.d[rows[a]];
+        if (h_selection)
+        {
+            const int k = h_index[rows[a]];
+            for (int j = 0; j < N; j++) f[j] = (j < k) ? 0 : U[k][j];
+            innovation -= dx[k];
+        }
+        else
+        {
+            const double *h_row = H.d[rows[a]];
+            for (int j = 0; j < N; j++)
+            {
+                T acc = 0;
+                for (int i = 0; i <= j; i++) acc += U[i][j] * h_row[i];
+                f[j] = acc;
+                innovation -= h_row[j] * dx[j];
+            }
+        }
+        if (row_wrap[rows[a]]) innovation = headingDifference(innovation);
+        for (int j = 0; j < N; j++) b[j] = D[j] * f[j];
+        if ((adapt_window > 0) || (gate > 0))
+        {
+            // h*P*h^T = f^T*D*f
+            T hph = 0;
+            for (int j = 0; j < N; j++) hph += f[j] * b[j];
+            if (adapt_window > 0) adaptNoise(rows[a], innovation, hph);
+            const T s = hph + R[rows[a]][rows[a]];
+            if ((gate > 0) && gateRejects(rows[a], innovation, s)) continue;
+        }
+        T alpha = R[rows[a]][rows[a]];
+        if (!(alpha > 0))
+        {
+            ok = false;
+            continue;
+        }
+        T gamma = 1 / alpha;
+        for (int j = 0; j < N; j++)
+        {
+            T beta = alpha;
+            alpha += f[j] * b[j];
+            T lambda = -f[j] * gamma;
+            gamma = 1 / alpha;
+            D[j] *= beta * gamma;
+            for (int i = 0; i < j; i++)
+            {
+                T u = U[i][j];
+                U[i][j] = u + (b[i] * lambda);
+                b[i] += b[j] * u;
+            }
+        }
+        // gain = b / alpha
+        for (int i = 0; i < N; i++)
+        {
+            T correction = gamma * b[i] * innovation;
+            x_est[i] += correction;
+            dx[i] += correction;
+        }
+    }
+    composeP();
+    step++;
+    return ok;
+}
+
+// Factor a symmetric positive definite A = U*D*U^T
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::factorUD(const T (*A)[NP], T (*U_out)[N], T *D_out)
+{
+    for (int j = N - 1; j >= 0; j--)
+    {
+        T diag = A[j][j];
+        for (int k = j + 1; k < N; k++) diag -= D_out[k] * U_out[j][k] * U_out[j][k];
+        if (!(diag > 0)) return false;
+        D_out[j] = diag;
+        U_out[j][j] = 1;
+        for (int i = 0; i < j; i++)
+        {
+            T acc = A[i][j];
+            for (int k = j + 1; k < N; k++) acc -= D_out[k] * U_out[i][k] * U_out[j][k];
+            U_out[i][j] = acc / diag;
+        }
+        for (int i = j + 1; i < N; i++) U_out[i][j] = 0;
+    }
+    return true;
+}
+
+// P = U*D*U^T, which is symmetric by construction
+template <int N, int M, typename T>
+void FixedEKF<N, M, T>::composeP()
+{
+    for (int i = 0; i < N; i++)
+    {
+        for (int j = i; j < N; j++)
+        {
+            T acc = 0;
+            for (int k = j; k < N; k++) acc += U[i][k] * D[k] * U[j][k];
+            P[i][j] = acc;
+            P[j][i] = acc;
+        }
+    }
+}
+
+// Factor S = C*C^T, leaving C in the lower triangle of S.
+template <int N, int M, typename T>
+bool FixedEKF<N, M, T>::choleskyInPlace(int m)
+{
+    for (int j = 0; j < m; j++)
+    {
+        T diag = S[j][j];
+        for (int k = 0; k < j; k++) diag -= S[j][k] * S[j][k];
+        if (!(diag > 0)) return false;
+        S[j][j] = sqrt(diag);
+        for (int i = j + 1; i < m; i++)
+        {
+            T acc = S[i][j];
+            for (int k = 0; k < j; k++) acc -= S[i][k] * S[j][k];
+            S[i][j] = acc / S[j][j];
+        }
+    }
+    return true;
+}
+
+template <int N, int M, typename T>
+void FixedEKF<N, M, T>::symmetrize()
+{
+    for (int i = 0; i < N; i++)
+    {
+        for (int j = i + 1; j < N; j++)
+        {
+            T mean = T(0.5) * (P[i][j] + P[j][i]);
+            P[i][j] = mean;
+            P[j][i] = mean;
+        }
+    }
+}
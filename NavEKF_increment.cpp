@@ -6,24 +6,39 @@
 /************************************************************/
 
 #include "NavEKF_increment.h"
+#include "NavEKF_angle.h"
 #include <cmath>
 
-const uint8_t state_count = 6;
-#define DEG2RAD (M_PI/180)
-
-const int NavState2D::getStateCount() {return state_count;}
-
-NavState2D::NavState2D(rc_matrix_t sensor_matrix, double time_step):
+NavState2D::NavState2D(rc_matrix_t sensor_matrix, double time_step, MotionModel *motion_model):
+nominal_dt(time_step),
 dt(time_step),
+model(motion_model ? motion_model : new NavModel2DFast()),
 H(rc_matrix_empty()),
+h_selection(true),
 F(rc_matrix_empty()),
 x_predict(rc_vector_empty()),
 y_predict(rc_vector_empty())
 {
     rc_matrix_duplicate(sensor_matrix, &H);
-    rc_vector_zeros(&x_predict, state_count);
+    h_index.resize(H.rows, -1);
+    for (int a = 0; a < H.rows; a++)
+    {
+        for (int k = 0; k < H.cols; k++)
+        {
+            if (H.d[a][k] == 0) continue;
+            if ((H.d[a][k] != 1) || (h_index[a] >= 0)) h_selection = false;
+            h_index[a] = k;
+        }
+        if (h_index[a] < 0) h_selection = false;
+    }
+    const int n = model->getStateCount();
+    wrap_axes.resize(n);
+    for (int i = 0; i < n; i++) wrap_axes[i] = model->wrapsAxis(i);
+    rc_vector_zeros(&x_predict, n);
     rc_vector_zeros(&y_predict, H.rows);
-    rc_matrix_zeros(&F, state_count, state_count);
+    // Models only write the nonzero entries of F, so it's zeroed just once
+    rc_matrix_zeros(&F, n, n);
+    x_scratch.resize(n);
 }
 
 NavState2D::~NavState2D()
@@ -32,60 +47,108 @@ NavState2D::~NavState2D()
     rc_vector_free(&y_predict);
     rc_matrix_free(&F);
     rc_matrix_free(&H);
+    delete model;
 }
 
 void NavState2D::reset()
 {
-    rc_vector_zeros(&x_predict, state_count);
+    rc_vector_zeros(&x_predict, model->getStateCount());
     rc_vector_zeros(&y_predict, H.rows);
 }
 
 void NavState2D::tick(rc_vector_t *last_x)
 {
-    // propagate x_k
-    x_predict.d[state_axis_t::x] = last_x->d[state_axis_t::x] +
-        (dt * last_x->d[state_axis_t::v] * cos(last_x->d[state_axis_t::theta] * DEG2RAD)) +
-        (0.5 * dt * dt * last_x->d[state_axis_t::v_dot] * cos(last_x->d[state_axis_t::theta] * DEG2RAD));
-    // propagate y_k
-    x_predict.d[state_axis_t::y] = last_x->d[state_axis_t::y] +
-        (dt * last_x->d[state_axis_t::v] * sin(last_x->d[state_axis_t::theta] * DEG2RAD)) +
-        (0.5 * dt * dt * last_x->d[state_axis_t::v_dot] * sin(last_x->d[state_axis_t::theta] * DEG2RAD));
-    // propagate theta_k (heading)
-    x_predict.d[state_axis_t::theta] = last_x->d[state_axis_t::theta] +
-        (dt * last_x->d[state_axis_t::theta_dot]);
-    // propagate v_k (velocity)
-    x_predict.d[state_axis_t::v] = last_x->d[state_axis_t::v] +
-        (dt * last_x->d[state_axis_t::v_dot]);
-    // propagate theta_dot_k (yaw rate)
-    x_predict.d[state_axis_t::theta_dot] = last_x->d[state_axis_t::theta_dot];
-    // propagate v_dot_k (acceleration)
-    x_predict.d[state_axis_t::v_dot] = last_x->d[state_axis_t::v_dot];
-    rc_matrix_times_col_vec(H, x_predict, &y_predict);  // predict sensor values
-    calcF(last_x);                                  // compute Jacobian
+    tick(last_x, nominal_dt);
+}
+
+void NavState2D::tick(rc_vector_t *last_x, double step_dt)
+{
+    dt = step_dt;
+    // predict the state and compute the Jacobian
+    model->predict(last_x->d, dt, x_predict.d, F.d);
+    // predict sensor values
+    if (h_selection)
+    {
+        for (int a = 0; a < H.rows; a++) y_predict.d[a] = x_predict.d[h_index[a]];
+    }
+    else
+    {
+        rc_matrix_times_col_vec(H, x_predict, &y_predict);
+    }
 }
 
 void NavState2D::calcF(rc_vector_t *x)
 {
-    rc_matrix_zeros(&F, state_count, state_count);
-    F.d[state_axis_t::x][state_axis_t::x] = 1;
-    F.d[state_axis_t::x][state_axis_t::theta] =
-        (-(x->d[state_axis_t::v] * dt * DEG2RAD * sin(x->d[state_axis_t::theta] * DEG2RAD)) -
-        (0.5 * dt * dt * x->d[state_axis_t::v_dot] * DEG2RAD * sin(x->d[state_axis_t::theta] * DEG2RAD)))
-        * x->d[state_axis_t::theta_dot] * dt;
-    F.d[state_axis_t::x][state_axis_t::v] = (dt * cos(x->d[state_axis_t::theta] * DEG2RAD));
-    F.d[state_axis_t::x][state_axis_t::v_dot] = (0.5 * dt * dt * cos(x->d[state_axis_t::theta] * DEG2RAD));
-    F.d[state_axis_t::y][state_axis_t::y] = 1;
-    F.d[state_axis_t::y][state_axis_t::theta] =
-        ((x->d[state_axis_t::v] * dt * DEG2RAD * cos(x->d[state_axis_t::theta] * DEG2RAD)) +
-        (0.5 * dt * dt * x->d[state_axis_t::v_dot] * DEG2RAD * cos(x->d[state_axis_t::theta] * DEG2RAD)))
-        * x->d[state_axis_t::theta_dot] * dt;
-    F.d[state_axis_t::y][state_axis_t::v] = (dt * sin(x->d[state_axis_t::theta] * DEG2RAD));
-    F.d[state_axis_t::y][state_axis_t::v_dot] = (0.5 * dt * dt * sin(x->d[state_axis_t::theta] * DEG2RAD));
-    F.d[state_axis_t::theta][state_axis_t::theta] = 1;
-    F.d[state_axis_t::theta][state_axis_t::theta_dot] = dt;
-    F.d[state_axis_t::v][state_axis_t::v] = 1;
-    F.d[state_axis_t::v][state_axis_t::v_dot] = dt;
-    F.d[state_axis_t::theta_dot][state_axis_t::theta_dot] = 1;
-    F.d[state_axis_t::v_dot][state_axis_t::v_dot] = 1;
-    // rc_matrix_transpose_inplace(&F);
+    model->predict(x->d, dt, x_scratch.data(), F.d);
+}
+
+void NavState2D::wrapMeasurement(const rc_vector_t &y, rc_vector_t *y_out)
+{
+    for (int a = 0; a < H.rows; a++)
+    {
+        y_out->d[a] = y.d[a];
+        if (!(h_selection && wrap_axes[h_index[a]])) continue;
+        y_out->d[a] = y_predict.d[a] + headingDifference(y.d[a] - y_predict.d[a]);
+    }
+}
+
+void NavState2D::wrapState(rc_vector_t *x)
+{
+    for (int i = 0; i < x->len; i++)
+    {
+        if (wrap_axes[i]) x->d[i] = wrapHeading(x->d[i]);
+    }
+}
+
+MeasurementSubset::MeasurementSubset(int inputs, int states):
+H_block(rc_matrix_empty()),
+R_block(rc_matrix_empty()),
+y_block(rc_vector_empty()),
+h_block(rc_vector_empty()),
+H_rows(inputs, nullptr),
+R_rows(inputs, nullptr)
+{
+    rc_matrix_zeros(&H_block, inputs, states);
+    rc_matrix_zeros(&R_block, inputs, inputs);
+    rc_vector_zeros(&y_block, inputs);
+    rc_vector_zeros(&h_block, inputs);
+    H_view = H_block;
+    R_view = R_block;
+    y_view = y_block;
+    h_view = h_block;
+}
+
+MeasurementSubset::~MeasurementSubset()
+{
+    // the views borrow the blocks' storage
+    rc_matrix_free(&H_block);
+    rc_matrix_free(&R_block);
+    rc_vector_free(&y_block);
+    rc_vector_free(&h_block);
+}
+
+void MeasurementSubset::select(const rc_matrix_t &H, const rc_matrix_t &R, const rc_vector_t &y,
+    const rc_vector_t &h, const int *rows, int count)
+{
+    // Each row of the view is as long as the view is wide, starting at d[0]
+    double *H_data = H_block.d[0];
+    double *R_data = R_block.d[0];
+    for (int k = 0; k < count; k++)
+    {
+        const int a = rows[k];
+        H_rows[k] = H_data + (k * H.cols);
+        R_rows[k] = R_data + (k * count);
+        for (int j = 0; j < H.cols; j++) H_rows[k][j] = H.d[a][j];
+        for (int l = 0; l < count; l++) R_rows[k][l] = R.d[a][rows[l]];
+        y_block.d[k] = y.d[a];
+        h_block.d[k] = h.d[a];
+    }
+    H_view.rows = count;
+    H_view.cols = H.cols;
+    H_view.d = H_rows.data();
+    R_view.rows = count;
+    R_view.cols = count;
+    R_view.d = R_rows.data();
+    y_view.len = count;
+    h_view.len = count;
 }
@@ -7,40 +7,88 @@
 
 #pragma once
 
+#include <vector>
+#include "NavEKF_model.h"
+
 extern "C" {
     #include "roboticscape.h"
 }
 
 using namespace std;
 
-enum state_axis_t : uint8_t {
-    x           = 0,
-    y           = 1,
-    theta       = 2,
-    v           = 3,
-    theta_dot   = 4,
-    v_dot       = 5
-};
-
 class NavState2D
 {
 public:
-    NavState2D(rc_matrix_t sensor_matrix, double time_step);
+    // time_step is the nominal step used by tick() without an explicit dt.
+    // The state takes ownership of motion_model; without one it uses
+    // NavModel2DFast. The state is sized to the model, so the sensor
+    // matrix must have one column per model state.
+    NavState2D(rc_matrix_t sensor_matrix, double time_step, MotionModel *motion_model = nullptr);
     ~NavState2D();
 
     void tick(rc_vector_t *last_x);
+    void tick(rc_vector_t *last_x, double step_dt);
     void reset();
+    // Jacobian of the motion model at x, for the current step length.
+    // tick() calls this itself.
+    void calcF(rc_vector_t *x);
     const rc_matrix_t &getF() {return F;};
     const rc_matrix_t &getH() {return H;};
     const rc_vector_t &getXPrediction() {return x_predict;};
     const rc_vector_t &getYPrediction() {return y_predict;};
-    static const int getStateCount();
+    double getNominalTimeStep() {return nominal_dt;};
+    double getTimeStep() {return dt;};
+    int getStateCount() const {return model->getStateCount();};
+    // One flag per state, nonzero for a heading, for FixedEKF::setWrapAxes()
+    const uint8_t *getWrapAxes() const {return wrap_axes.data();};
+    // y with each heading row moved by whole turns to within 180 degrees
+    // of the last predicted measurement, so that y - h is the short way
+    // round. Rows that aren't headings are copied. y_out must have as
+    // many entries as y.
+    void wrapMeasurement(const rc_vector_t &y, rc_vector_t *y_out);
+    // Put each heading of x back in [0, 360)
+    void wrapState(rc_vector_t *x);
 private:
-    const double dt;
+    const double nominal_dt;
+    double dt;      // step length of the last tick
+    MotionModel *model;
     rc_matrix_t H;
+    // When each row of H picks out a single state, y = H*x is a gather
+    bool h_selection;
+    vector<int> h_index;
+    vector<uint8_t> wrap_axes;
     rc_matrix_t F;
     rc_vector_t x_predict;
     rc_vector_t y_predict;
+    vector<double> x_scratch;
+};
 
-    void calcF(rc_vector_t *x);
+// The rows of a measurement picked out by index, for librobotcontrol,
+// which can't select rows of H itself. Its matrix functions copy and add
+// from d[0] as one block, so the rows are copied end to end into storage
+// allocated once for every input, and viewed at the size in use.
+class MeasurementSubset
+{
+public:
+    MeasurementSubset(int inputs, int states);
+    ~MeasurementSubset();
+    // Gather rows of H, R, y and h, in order. The views stay valid until
+    // the next select().
+    void select(const rc_matrix_t &H, const rc_matrix_t &R, const rc_vector_t &y,
+        const rc_vector_t &h, const int *rows, int count);
+    const rc_matrix_t &getH() {return H_view;};
+    const rc_matrix_t &getR() {return R_view;};
+    const rc_vector_t &getY() {return y_view;};
+    const rc_vector_t &getYPrediction() {return h_view;};
+private:
+    rc_matrix_t H_block;
+    rc_matrix_t R_block;
+    rc_vector_t y_block;
+    rc_vector_t h_block;
+    vector<double *> H_rows;
+    vector<double *> R_rows;
+    rc_matrix_t H_view;
+    rc_matrix_t R_view;
+    rc_vector_t y_view;
+    rc_vector_t h_view;
 };
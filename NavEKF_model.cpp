@@ -0,0 +1,89 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: NavEKF_model.cpp                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#include "NavEKF_model.h"
+
+const char *const NavModelCV::axis_names[] = {"X", "Y", "X_DOT", "Y_DOT"};
+const char *const NavModelCTRV::axis_names[] = {"X", "Y", "THETA", "V", "THETA_DOT"};
+const char *const NavModel2D::axis_names[] = {"X", "Y", "THETA", "V", "THETA_DOT", "V_DOT"};
+const char *const NavModel3D::axis_names[] =
+    {"X", "Y", "DEPTH", "THETA", "PITCH", "V", "THETA_DOT", "V_DOT"};
+
+int MotionModel::findAxis(const string &name) const
+{
+    for (int i = 0; i < getStateCount(); i++)
+    {
+        if (name == getAxisName(i)) return i;
+    }
+    return -1;
+}
+
+MotionModel *createMotionModel(const string &name, bool autodiff_jacobian)
+{
+    if (name == "CV") return new NavModelCV();
+    if (name == "CTRV") return new NavModelCTRV();
+    if (name == "CTRA")
+    {
+        if (autodiff_jacobian) return new NavModel2D();
+        return new NavModel2DFast();
+    }
+    if (name == "3D") return new NavModel3D();
+    return nullptr;
+}
+
+NavModel2DFast::NavModel2DFast()
+{
+    setTimeStep(0);
+}
+
+// Rebuild the terms that depend only on the step length. Steps are
+// usually the same length from one call to the next, so this is skipped
+// unless the step actually changes.
+void NavModel2DFast::setTimeStep(double step_dt)
+{
+    dt = step_dt;
+    half_dt_sq = 0.5 * dt * dt;
+    dt_rad = dt * deg2rad;
+    half_dt_sq_rad = half_dt_sq * deg2rad;
+}
+
+void NavModel2DFast::predict(const double *x, double step_dt, double *x_next, double **F)
+{
+    if (step_dt != dt) setTimeStep(step_dt);
+    // One sin/cos pair serves both the prediction and the Jacobian; the
+    // compiler merges the two into a single sincos call. The heading is
+    // narrowed to the propagation precision first so that sin() and cos()
+    // pick the matching overload.
+    const prop_real_t heading = prop_real_t(x[state_axis_t::theta] * deg2rad);
+    const double sin_theta = sin(heading);
+    const double cos_theta = cos(heading);
+    // distance along the heading over the step
+    const double dist = (dt * x[state_axis_t::v]) + (half_dt_sq * x[state_axis_t::v_dot]);
+    x_next[state_axis_t::x] = x[state_axis_t::x] + (dist * cos_theta);
+    x_next[state_axis_t::y] = x[state_axis_t::y] + (dist * sin_theta);
+    x_next[state_axis_t::theta] = x[state_axis_t::theta] + (dt * x[state_axis_t::theta_dot]);
+    x_next[state_axis_t::v] = x[state_axis_t::v] + (dt * x[state_axis_t::v_dot]);
+    x_next[state_axis_t::theta_dot] = x[state_axis_t::theta_dot];
+    x_next[state_axis_t::v_dot] = x[state_axis_t::v_dot];
+    if (!F) return;
+    // the same distance, per degree of heading
+    const double dist_rad = (x[state_axis_t::v] * dt_rad) + (x[state_axis_t::v_dot] * half_dt_sq_rad);
+    F[state_axis_t::x][state_axis_t::x] = 1;
+    F[state_axis_t::x][state_axis_t::theta] = -(dist_rad * sin_theta);
+    F[state_axis_t::x][state_axis_t::v] = dt * cos_theta;
+    F[state_axis_t::x][state_axis_t::v_dot] = half_dt_sq * cos_theta;
+    F[state_axis_t::y][state_axis_t::y] = 1;
+    F[state_axis_t::y][state_axis_t::theta] = dist_rad * cos_theta;
+    F[state_axis_t::y][state_axis_t::v] = dt * sin_theta;
+    F[state_axis_t::y][state_axis_t::v_dot] = half_dt_sq * sin_theta;
+    F[state_axis_t::theta][state_axis_t::theta] = 1;
+    F[state_axis_t::theta][state_axis_t::theta_dot] = dt;
+    F[state_axis_t::v][state_axis_t::v] = 1;
+    F[state_axis_t::v][state_axis_t::v_dot] = dt;
+    F[state_axis_t::theta_dot][state_axis_t::theta_dot] = 1;
+    F[state_axis_t::v_dot][state_axis_t::v_dot] = 1;
+}
@@ -0,0 +1,360 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: NavEKF_model.h                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <string>
+
+using namespace std;
+
+// States in the default model, NavModel2D
+const uint8_t state_count = 6;
+// States in the largest model in the registry
+const uint8_t max_state_count = 8;
+
+// Precision of the trig in the motion model. The state itself stays double.
+#ifdef NAVEKF_FLOAT_PROPAGATION
+typedef float prop_real_t;
+#else
+typedef double prop_real_t;
+#endif
+
+const double deg2rad = M_PI / 180;
+
+// Axes of NavModel2D. The other models define their own.
+enum state_axis_t : uint8_t {
+    x           = 0,
+    y           = 1,
+    theta       = 2,
+    v           = 3,
+    theta_dot   = 4,
+    v_dot       = 5
+};
+
+// Forward-mode dual number: a value and its derivatives with respect to
+// N independent inputs. Evaluating a function on duals seeded with the
+// identity gives its value and its whole Jacobian in one pass.
+template <int N>
+struct dual_t {
+    double v;
+    double d[N];
+
+    dual_t(): v(0) {for (int i = 0; i < N; i++) d[i] = 0;};
+    dual_t(double value): v(value) {for (int i = 0; i < N; i++) d[i] = 0;};
+};
+
+template <int N>
+inline dual_t<N> operator+(const dual_t<N> &a, const dual_t<N> &b)
+{
+    dual_t<N> r(a.v + b.v);
+    for (int i = 0; i < N; i++) r.d[i] = a.d[i] + b.d[i];
+    return r;
+}
+
+template <int N>
+inline dual_t<N> operator-(const dual_t<N> &a, const dual_t<N> &b)
+{
+    dual_t<N> r(a.v - b.v);
+    for (int i = 0; i < N; i++) r.d[i] = a.d[i] - b.d[i];
+    return r;
+}
+
+template <int N>
+inline dual_t<N> operator-(const dual_t<N> &a)
+{
+    dual_t<N> r(-a.v);
+    for (int i = 0; i < N; i++) r.d[i] = -a.d[i];
+    return r;
+}
+
+template <int N>
+inline dual_t<N> operator*(const dual_t<N> &a, const dual_t<N> &b)
+{
+    dual_t<N> r(a.v * b.v);
+    for (int i = 0; i < N; i++) r.d[i] = (a.d[i] * b.v) + (a.v * b.d[i]);
+    return r;
+}
+
+template <int N>
+inline dual_t<N> operator/(const dual_t<N> &a, const dual_t<N> &b)
+{
+    dual_t<N> r(a.v / b.v);
+    for (int i = 0; i < N; i++) r.d[i] = ((a.d[i] * b.v) - (a.v * b.d[i])) / (b.v * b.v);
+    return r;
+}
+
+// Constants need no derivative terms, so they get their own overloads
+template <int N>
+inline dual_t<N> operator+(const dual_t<N> &a, double b)
+{
+    dual_t<N> r(a);
+    r.v += b;
+    return r;
+}
+
+template <int N>
+inline dual_t<N> operator+(double a, const dual_t<N> &b) {return b + a;}
+
+template <int N>
+inline dual_t<N> operator-(const dual_t<N> &a, double b) {return a + (-b);}
+
+template <int N>
+inline dual_t<N> operator-(double a, const dual_t<N> &b) {return (-b) + a;}
+
+template <int N>
+inline dual_t<N> operator*(const dual_t<N> &a, double b)
+{
+    dual_t<N> r(a.v * b);
+    for (int i = 0; i < N; i++) r.d[i] = a.d[i] * b;
+    return r;
+}
+
+template <int N>
+inline dual_t<N> operator*(double a, const dual_t<N> &b) {return b * a;}
+
+template <int N>
+inline dual_t<N> operator/(const dual_t<N> &a, double b) {return a * (1 / b);}
+
+template <int N>
+inline dual_t<N> sin(const dual_t<N> &a)
+{
+    const double c = std::cos(a.v);
+    dual_t<N> r(std::sin(a.v));
+    for (int i = 0; i < N; i++) r.d[i] = c * a.d[i];
+    return r;
+}
+
+template <int N>
+inline dual_t<N> cos(const dual_t<N> &a)
+{
+    const double s = std::sin(a.v);
+    dual_t<N> r(std::cos(a.v));
+    for (int i = 0; i < N; i++) r.d[i] = -s * a.d[i];
+    return r;
+}
+
+template <int N>
+inline dual_t<N> sqrt(const dual_t<N> &a)
+{
+    const double root = std::sqrt(a.v);
+    dual_t<N> r(root);
+    for (int i = 0; i < N; i++) r.d[i] = a.d[i] / (2 * root);
+    return r;
+}
+
+// A motion model maps the state over one step, x_next = f(x, dt), and
+// supplies the Jacobian F = df/dx at x. F is written through row
+// pointers, as in rc_matrix_t::d, and may be nullptr if only the
+// prediction is wanted.
+class MotionModel
+{
+public:
+    virtual ~MotionModel() {}
+    virtual int getStateCount() const = 0;
+    // Upper case name of each axis, as used by INPUT_TYPE and <AXIS>_OUT
+    virtual const char *getAxisName(int axis) const = 0;
+    // True for an axis that is a heading in degrees, which the filter
+    // keeps in [0, 360) and differences the short way round
+    virtual bool wrapsAxis(int /*axis*/) const {return false;};
+    virtual void predict(const double *x, double dt, double *x_next, double **F) = 0;
+    // A new model of the same kind. predict() may keep scratch terms
+    // between calls, so each thread that predicts needs its own.
+    virtual MotionModel *clone() const = 0;
+    // Index of the axis with this (upper case) name, or -1
+    int findAxis(const string &name) const;
+};
+
+// Builds the model selected by MOTION_MODEL (CV, CTRV, CTRA or 3D), or
+// returns nullptr if there is no model by that name. autodiff_jacobian
+// picks the generated Jacobian for models that also have a hand-written
+// one.
+MotionModel *createMotionModel(const string &name, bool autodiff_jacobian);
+
+// Motion model whose Jacobian is generated from its propagation function
+// by forward-mode differentiation. MODEL only has to provide
+//
+//   template <typename S>
+//   static void propagate(const S *x, double dt, S *x_next);
+//
+// written once for any scalar type S. It is instantiated for double to
+// predict and for dual_t<N> to differentiate, so the Jacobian can never
+// disagree with the model. A model that needs the speed can still
+// override predict() with a hand-written Jacobian and be tested against
+// this one. MODEL also lists its axis names in axis_names[], and gives
+// the axis of its heading as heading_axis, or -1 if it has none.
+template <class MODEL, int N>
+class AutoDiffModel : public MotionModel
+{
+public:
+    static const int state_dim = N;
+
+    int getStateCount() const {return N;};
+    const char *getAxisName(int axis) const {return MODEL::axis_names[axis];};
+    bool wrapsAxis(int axis) const {return (axis == MODEL::heading_axis);};
+    MotionModel *clone() const {return new MODEL();};
+
+    void predict(const double *x, double dt, double *x_next, double **F)
+    {
+        if (!F)
+        {
+            MODEL::propagate(x, dt, x_next);
+            return;
+        }
+        for (int i = 0; i < N; i++)
+        {
+            x_dual[i] = dual_t<N>(x[i]);
+            x_dual[i].d[i] = 1;
+        }
+        MODEL::propagate(x_dual, dt, x_next_dual);
+        for (int i = 0; i < N; i++)
+        {
+            x_next[i] = x_next_dual[i].v;
+            for (int j = 0; j < N; j++) F[i][j] = x_next_dual[i].d[j];
+        }
+    }
+
+private:
+    dual_t<N> x_dual[N];
+    dual_t<N> x_next_dual[N];
+};
+
+// Planar vehicle moving at a constant velocity, held as its x and y
+// components. It has no heading, so it suits a sensor that only
+// reports position.
+class NavModelCV : public AutoDiffModel<NavModelCV, 4>
+{
+public:
+    enum axis_t : uint8_t {
+        x       = 0,
+        y       = 1,
+        x_dot   = 2,
+        y_dot   = 3
+    };
+    static const char *const axis_names[];
+    static const int heading_axis = -1;
+
+    template <typename S>
+    static void propagate(const S *s, double dt, S *s_next)
+    {
+        s_next[x] = s[x] + (dt * s[x_dot]);
+        s_next[y] = s[y] + (dt * s[y_dot]);
+        s_next[x_dot] = s[x_dot];
+        s_next[y_dot] = s[y_dot];
+    }
+};
+
+// Planar vehicle with constant yaw rate and constant speed (CTRV).
+// Heading and yaw rate are in degrees.
+class NavModelCTRV : public AutoDiffModel<NavModelCTRV, 5>
+{
+public:
+    enum axis_t : uint8_t {
+        x           = 0,
+        y           = 1,
+        theta       = 2,
+        v           = 3,
+        theta_dot   = 4
+    };
+    static const char *const axis_names[];
+    static const int heading_axis = theta;
+
+    template <typename S>
+    static void propagate(const S *s, double dt, S *s_next)
+    {
+        const S heading = s[theta] * deg2rad;
+        const S dist = dt * s[v];
+        s_next[x] = s[x] + (dist * cos(heading));
+        s_next[y] = s[y] + (dist * sin(heading));
+        s_next[theta] = s[theta] + (dt * s[theta_dot]);
+        s_next[v] = s[v];
+        s_next[theta_dot] = s[theta_dot];
+    }
+};
+
+// Planar vehicle with constant yaw rate and constant acceleration along
+// its heading (CTRA). Heading and yaw rate are in degrees. This is the
+// default model and its axes are state_axis_t.
+class NavModel2D : public AutoDiffModel<NavModel2D, state_count>
+{
+public:
+    static const char *const axis_names[];
+    static const int heading_axis = state_axis_t::theta;
+
+    template <typename S>
+    static void propagate(const S *x, double dt, S *x_next)
+    {
+        const S heading = x[state_axis_t::theta] * deg2rad;
+        // distance along the heading over the step
+        const S dist = (dt * x[state_axis_t::v]) + ((0.5 * dt * dt) * x[state_axis_t::v_dot]);
+        x_next[state_axis_t::x] = x[state_axis_t::x] + (dist * cos(heading));
+        x_next[state_axis_t::y] = x[state_axis_t::y] + (dist * sin(heading));
+        x_next[state_axis_t::theta] = x[state_axis_t::theta] + (dt * x[state_axis_t::theta_dot]);
+        x_next[state_axis_t::v] = x[state_axis_t::v] + (dt * x[state_axis_t::v_dot]);
+        x_next[state_axis_t::theta_dot] = x[state_axis_t::theta_dot];
+        x_next[state_axis_t::v_dot] = x[state_axis_t::v_dot];
+    }
+};
+
+// NavModel2D with depth and pitch added, for underwater vehicles. The
+// speed is along the vehicle's axis, so pitch splits the distance run
+// between the horizontal and depth. Depth is positive down and pitch is
+// positive nose up, in degrees, and is held constant over the step.
+class NavModel3D : public AutoDiffModel<NavModel3D, 8>
+{
+public:
+    enum axis_t : uint8_t {
+        x           = 0,
+        y           = 1,
+        depth       = 2,
+        theta       = 3,
+        pitch       = 4,
+        v           = 5,
+        theta_dot   = 6,
+        v_dot       = 7
+    };
+    static const char *const axis_names[];
+    static const int heading_axis = theta;
+
+    template <typename S>
+    static void propagate(const S *s, double dt, S *s_next)
+    {
+        const S heading = s[theta] * deg2rad;
+        const S elevation = s[pitch] * deg2rad;
+        const S dist = (dt * s[v]) + ((0.5 * dt * dt) * s[v_dot]);
+        const S horizontal = dist * cos(elevation);
+        s_next[x] = s[x] + (horizontal * cos(heading));
+        s_next[y] = s[y] + (horizontal * sin(heading));
+        s_next[depth] = s[depth] - (dist * sin(elevation));
+        s_next[theta] = s[theta] + (dt * s[theta_dot]);
+        s_next[pitch] = s[pitch];
+        s_next[v] = s[v] + (dt * s[v_dot]);
+        s_next[theta_dot] = s[theta_dot];
+        s_next[v_dot] = s[v_dot];
+    }
+};
+
+// NavModel2D with a hand-written Jacobian. The sin/cos pair and the
+// terms that depend only on dt are computed once and shared, and only
+// the nonzero entries of F are written, so F must start out zeroed.
+class NavModel2DFast : public NavModel2D
+{
+public:
+    NavModel2DFast();
+    void predict(const double *x, double dt, double *x_next, double **F);
+    MotionModel *clone() const {return new NavModel2DFast();};
+
+private:
+    // Step length of the last call and the terms derived from it
+    double dt;
+    double half_dt_sq;
+    double dt_rad;
+    double half_dt_sq_rad;
+
+    void setTimeStep(double step_dt);
+};
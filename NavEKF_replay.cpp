@@ -0,0 +1,204 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: NavEKF_replay.cpp                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#include "NavEKF_replay.h"
+#include "MBUtils.h"
+#include <cstdio>
+
+NavReplay::NavReplay():
+log_time(0),
+first_tick(0),
+last_tick(0),
+messages(0),
+records(0),
+last_step(0)
+{
+}
+
+//---------------------------------------------------------
+// Procedure: configure()
+
+bool NavReplay::configure(const string &mission_file, const string &app_name)
+{
+    m_sAppName = app_name;
+    m_MissionReader.SetAppName(m_sAppName);
+    if (!m_MissionReader.SetFile(mission_file)) return false;
+    // Run() would normally pick up AppTick, and the tick mode step and
+    // the scaling of Q both depend on it
+    double app_tick = 0;
+    if (m_MissionReader.GetConfigurationParam("AppTick", app_tick) && (app_tick > 0))
+    {
+        SetAppFreq(app_tick);
+    }
+    offline = true;
+    return OnStartUp();
+}
+
+//---------------------------------------------------------
+// Procedure: run()
+
+bool NavReplay::run(istream &alog, ostream &out, replay_format_t format)
+{
+    AlogReader reader(alog);
+    alog_entry_t entry;
+    const double period = 1 / GetAppFreq();
+    uint64_t tick_count = 0;
+    writeHeader(out, format);
+    while (reader.next(entry))
+    {
+        if (!(entry.numeric && findInputSlots(entry.var))) continue;
+        // Ticks start at the first input and are counted rather than
+        // summed, so a long log doesn't drift off AppTick
+        if (messages == 0) first_tick = entry.time;
+        double next_tick = first_tick + (tick_count * period);
+        while (entry.time > next_tick)
+        {
+            tick(next_tick, out, format);
+            next_tick = first_tick + (++tick_count * period);
+        }
+        mail.push_back(CMOOSMsg(MOOS_NOTIFY, entry.var, entry.number, entry.time));
+        messages++;
+    }
+    if (!mail.empty()) tick(first_tick + (tick_count * period), out, format);
+    out.flush();
+    return out.good();
+}
+
+//---------------------------------------------------------
+// Procedure: loadTuner()
+
+bool NavReplay::loadTuner(istream &alog, NoiseTuner &tuner,
+    const vector<pair<string, string>> &references)
+{
+    // The tuner always runs the fixed engine, which gives the rc engine's
+    // answer for the same settings
+    if (!nav_state) return false;
+    if (!tuner.init(model_name, autodiff_jacobian, sensor_estimation_matrix,
+        nav_state->getNominalTimeStep(), (fusion_mode == fusion_event)))
+    {
+        return false;
+    }
+    tuner.setSequential(sequential_update);
+    tuner.setFactorized(factorized_covariance);
+    tuner.setAdaptive(adaptive_window, adaptive_min_scale, adaptive_max_scale);
+    tuner.setGate(innovation_gate, gate_limit);
+    // Per-axis and per-input noise scale along with the settings swept.
+    // They're relative to the scalar settings, so without a positive one
+    // to divide by every axis or input is weighted the same.
+    vector<double> q_weights(proc_noise_axes.size(), 1);
+    vector<double> r_weights(meas_noise_inputs.size(), 1);
+    if (proc_noise > 0)
+    {
+        for (int i = 0; i < q_weights.size(); i++) q_weights[i] = proc_noise_axes[i] / proc_noise;
+    }
+    if (meas_noise > 0)
+    {
+        for (int a = 0; a < r_weights.size(); a++) r_weights[a] = meas_noise_inputs[a] / meas_noise;
+    }
+    if (!tuner.setNoiseWeights(q_weights, r_weights)) return false;
+    if (!tuner.setTimeouts(timeout_inputs)) return false;
+    // Logged variable to state axis, resolved against the model once
+    MotionModel *model = createMotionModel(model_name, autodiff_jacobian);
+    unordered_map<string, int> reference_axes;
+    for (auto &ref : references)
+    {
+        int axis = model->findAxis(toupper(ref.second));
+        if (axis < 0)
+        {
+            delete model;
+            return false;
+        }
+        reference_axes[toupper(ref.first)] = axis;
+    }
+    delete model;
+    AlogReader reader(alog);
+    alog_entry_t entry;
+    while (reader.next(entry))
+    {
+        if (!(entry.numeric && isfinite(entry.number))) continue;
+        auto slots = findInputSlots(entry.var);
+        if (slots)
+        {
+            for (int i : *slots) tuner.addSample(entry.time, i, entry.number);
+        }
+        if (reference_axes.empty()) continue;
+        auto ref = reference_axes.find(toupper(entry.var));
+        if (ref != reference_axes.end()) tuner.addReference(entry.time, ref->second, entry.number);
+    }
+    return true;
+}
+
+//---------------------------------------------------------
+// Procedure: tick()
+//            one AppTick at the given log time
+
+void NavReplay::tick(double time, ostream &out, replay_format_t format)
+{
+    log_time = time;
+    last_tick = time;
+    if (!mail.empty()) OnNewMail(mail);
+    mail.clear();
+    Iterate();
+    // In event mode a tick with no new samples leaves the filter alone
+    uint64_t step = filterStep();
+    if (step == last_step) return;
+    last_step = step;
+    writeRecord(out, format);
+}
+
+//---------------------------------------------------------
+// Procedure: writeHeader()
+//            CSV column names; binary records carry their own layout
+
+void NavReplay::writeHeader(ostream &out, replay_format_t format)
+{
+    if (format != replay_csv) return;
+    const vector<string> &names = getOutputVars();
+    out << "time,step";
+    for (auto &name : names) out << "," << name;
+    for (int i = 0; i < names.size(); i++)
+    {
+        for (int j = i; j < names.size(); j++) out << ",P_" << i << "_" << j;
+    }
+    out << "\n";
+}
+
+//---------------------------------------------------------
+// Procedure: writeRecord()
+//            the estimate and the upper triangle of P
+
+void NavReplay::writeRecord(ostream &out, replay_format_t format)
+{
+    const state_snapshot_t<max_state_count, max_inputs> &state = latestState();
+    records++;
+    if (format == replay_binary)
+    {
+        size_t len = encodeNavState(record, state.time, state.step, state.x, state.P, state.n);
+        out.write((const char *)record.data(), len);
+        return;
+    }
+    // Formatted into one reused buffer rather than through the stream
+    char field[32];
+    row.clear();
+    snprintf(field, sizeof(field), "%.6f,%llu", state.time, (unsigned long long)state.step);
+    row += field;
+    for (int i = 0; i < state.n; i++)
+    {
+        snprintf(field, sizeof(field), ",%.10g", state.x[i]);
+        row += field;
+    }
+    for (int i = 0; i < state.n; i++)
+    {
+        for (int j = i; j < state.n; j++)
+        {
+            snprintf(field, sizeof(field), ",%.10g", state.P[(i * state.n) + j]);
+            row += field;
+        }
+    }
+    row += '\n';
+    out.write(row.data(), row.size());
+}
@@ -0,0 +1,70 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: NavEKF_replay.h                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#pragma once
+
+#include "NavEKF.h"
+#include "NavEKF_alog.h"
+#include "NavEKF_tune.h"
+#include <iostream>
+
+using namespace std;
+
+enum replay_format_t : uint8_t {
+    replay_csv      = 0,    // one text row per filter step
+    replay_binary   = 1     // NavEKF_codec.h messages with covariance, back to back
+};
+
+// NavEKF driven from a MOOS .alog instead of a MOOSDB. The app is set
+// up from its mission file block exactly as it would be live, and every
+// logged INPUT is handed to the same OnNewMail() and Iterate() in log
+// time: the mail is batched up to each AppTick, and the clock the filter
+// steps against is the log's, so a mission replays as fast as the CPU
+// allows. Each filter step is written out as one record.
+class NavReplay : public NavEKF
+{
+public:
+    NavReplay();
+
+    // Read the app_name block of mission_file and start the filter
+    bool configure(const string &mission_file, const string &app_name = "pNavEKF");
+    // Replay every record of alog, writing the estimate and covariance to
+    // out. Returns false if out fails.
+    bool run(istream &alog, ostream &out, replay_format_t format);
+    vector<string> getConfigWarnings() const {return m_ac.getConfigWarnings();};
+    // Set tuner up as this app's filter is, and load it with the logged
+    // INPUT samples of alog. references maps logged variables holding the
+    // true value of a state to the name of that state's axis. If
+    // PROCESS_NOISE or MEASUREMENT_NOISE isn't positive, the axes or
+    // inputs are all weighted the same. Returns false if the filter or an
+    // axis name doesn't suit the tuner.
+    bool loadTuner(istream &alog, NoiseTuner &tuner, const vector<pair<string, string>> &references);
+    double getProcessNoise() const {return proc_noise;};
+    double getMeasurementNoise() const {return meas_noise;};
+
+    uint64_t getMessageCount() const {return messages;};
+    uint64_t getRecordCount() const {return records;};
+    double getLogDuration() const {return (last_tick - first_tick);};
+
+protected:
+    double currentTime() {return log_time;};
+
+private:
+    double log_time;
+    double first_tick;
+    double last_tick;
+    uint64_t messages;
+    uint64_t records;
+    uint64_t last_step;
+    MOOSMSG_LIST mail;
+    string row;
+    vector<uint8_t> record;
+
+    void tick(double time, ostream &out, replay_format_t format);
+    void writeHeader(ostream &out, replay_format_t format);
+    void writeRecord(ostream &out, replay_format_t format);
+};
@@ -0,0 +1,215 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: NavEKF_simd.h                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#pragma once
+
+// Row kernels for FixedEKF's small dense products. Every matrix they
+// touch is stored as rows of W elements, where W is the row length
+// rounded up to a whole number of SIMD registers and the padding is kept
+// zero, so a row is always processed in whole registers with no tail.
+//
+// The instruction set is picked from what the compiler targets: AVX or
+// SSE2 on x86, NEON on ARM (double only on AArch64). -DNAVEKF_NO_SIMD,
+// or no vector unit, leaves the plain loops.
+
+#if !defined(NAVEKF_NO_SIMD) && defined(__AVX__)
+#include <immintrin.h>
+#define NAVEKF_SIMD_AVX
+#elif !defined(NAVEKF_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define NAVEKF_SIMD_SSE2
+#elif !defined(NAVEKF_NO_SIMD) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define NAVEKF_SIMD_NEON
+#endif
+
+// Elements of T per SIMD register
+template <typename T>
+struct simd_lanes {static const int value = 1;};
+
+#if defined(NAVEKF_SIMD_AVX)
+template <> struct simd_lanes<double> {static const int value = 4;};
+template <> struct simd_lanes<float> {static const int value = 8;};
+#elif defined(NAVEKF_SIMD_SSE2)
+template <> struct simd_lanes<double> {static const int value = 2;};
+template <> struct simd_lanes<float> {static const int value = 4;};
+#elif defined(NAVEKF_SIMD_NEON)
+#if defined(__aarch64__)
+template <> struct simd_lanes<double> {static const int value = 2;};
+#endif
+template <> struct simd_lanes<float> {static const int value = 4;};
+#endif
+
+// Padded row length for n columns of T
+template <typename T>
+constexpr int simdWidth(int n)
+{
+    return (((n + simd_lanes<T>::value - 1) / simd_lanes<T>::value) * simd_lanes<T>::value);
+}
+
+// y += a*x and y = a*x over W elements, without intrinsics. These are
+// the fallback, and the baseline the benchmark compares against.
+template <int W, typename T>
+inline void scalarAxpy(T *y, T a, const T *x)
+{
+    for (int j = 0; j < W; j++) y[j] += a * x[j];
+}
+
+template <int W, typename T>
+inline void scalarScale(T *y, T a, const T *x)
+{
+    for (int j = 0; j < W; j++) y[j] = a * x[j];
+}
+
+template <int W, typename T>
+inline void simdAxpy(T *y, T a, const T *x)
+{
+    scalarAxpy<W>(y, a, x);
+}
+
+template <int W, typename T>
+inline void simdScale(T *y, T a, const T *x)
+{
+    scalarScale<W>(y, a, x);
+}
+
+// Rows are only 16 byte aligned, since that's all operator new promises
+// before C++17, so the 32 byte AVX registers use unaligned loads.
+#if defined(NAVEKF_SIMD_AVX)
+template <int W>
+inline void simdAxpy(double *y, double a, const double *x)
+{
+    const __m256d av = _mm256_set1_pd(a);
+    for (int j = 0; j < W; j += 4)
+    {
+        _mm256_storeu_pd(y + j, _mm256_add_pd(_mm256_loadu_pd(y + j), _mm256_mul_pd(av, _mm256_loadu_pd(x + j))));
+    }
+}
+
+template <int W>
+inline void simdScale(double *y, double a, const double *x)
+{
+    const __m256d av = _mm256_set1_pd(a);
+    for (int j = 0; j < W; j += 4) _mm256_storeu_pd(y + j, _mm256_mul_pd(av, _mm256_loadu_pd(x + j)));
+}
+
+template <int W>
+inline void simdAxpy(float *y, float a, const float *x)
+{
+    const __m256 av = _mm256_set1_ps(a);
+    for (int j = 0; j < W; j += 8)
+    {
+        _mm256_storeu_ps(y + j, _mm256_add_ps(_mm256_loadu_ps(y + j), _mm256_mul_ps(av, _mm256_loadu_ps(x + j))));
+    }
+}
+
+template <int W>
+inline void simdScale(float *y, float a, const float *x)
+{
+    const __m256 av = _mm256_set1_ps(a);
+    for (int j = 0; j < W; j += 8) _mm256_storeu_ps(y + j, _mm256_mul_ps(av, _mm256_loadu_ps(x + j)));
+}
+#elif defined(NAVEKF_SIMD_SSE2)
+template <int W>
+inline void simdAxpy(double *y, double a, const double *x)
+{
+    const __m128d av = _mm_set1_pd(a);
+    for (int j = 0; j < W; j += 2)
+    {
+        _mm_store_pd(y + j, _mm_add_pd(_mm_load_pd(y + j), _mm_mul_pd(av, _mm_load_pd(x + j))));
+    }
+}
+
+template <int W>
+inline void simdScale(double *y, double a, const double *x)
+{
+    const __m128d av = _mm_set1_pd(a);
+    for (int j = 0; j < W; j += 2) _mm_store_pd(y + j, _mm_mul_pd(av, _mm_load_pd(x + j)));
+}
+
+template <int W>
+inline void simdAxpy(float *y, float a, const float *x)
+{
+    const __m128 av = _mm_set1_ps(a);
+    for (int j = 0; j < W; j += 4)
+    {
+        _mm_store_ps(y + j, _mm_add_ps(_mm_load_ps(y + j), _mm_mul_ps(av, _mm_load_ps(x + j))));
+    }
+}
+
+template <int W>
+inline void simdScale(float *y, float a, const float *x)
+{
+    const __m128 av = _mm_set1_ps(a);
+    for (int j = 0; j < W; j += 4) _mm_store_ps(y + j, _mm_mul_ps(av, _mm_load_ps(x + j)));
+}
+#elif defined(NAVEKF_SIMD_NEON)
+#if defined(__aarch64__)
+template <int W>
+inline void simdAxpy(double *y, double a, const double *x)
+{
+    const float64x2_t av = vdupq_n_f64(a);
+    for (int j = 0; j < W; j += 2) vst1q_f64(y + j, vfmaq_f64(vld1q_f64(y + j), av, vld1q_f64(x + j)));
+}
+
+template <int W>
+inline void simdScale(double *y, double a, const double *x)
+{
+    const float64x2_t av = vdupq_n_f64(a);
+    for (int j = 0; j < W; j += 2) vst1q_f64(y + j, vmulq_f64(av, vld1q_f64(x + j)));
+}
+#endif
+
+template <int W>
+inline void simdAxpy(float *y, float a, const float *x)
+{
+    const float32x4_t av = vdupq_n_f32(a);
+    for (int j = 0; j < W; j += 4) vst1q_f32(y + j, vmlaq_f32(vld1q_f32(y + j), av, vld1q_f32(x + j)));
+}
+
+template <int W>
+inline void simdScale(float *y, float a, const float *x)
+{
+    const float32x4_t av = vdupq_n_f32(a);
+    for (int j = 0; j < W; j += 4) vst1q_f32(y + j, vmulq_f32(av, vld1q_f32(x + j)));
+}
+#endif
+
+// out = F*P*F^T + q*Q for N x N matrices in rows of W. Both products
+// are built a row at a time from scaled rows, F*P from the rows of P and
+// (F*P)*F^T from the rows of F^T, so every inner loop runs along a
+// contiguous row. FP and Ft are scratch, and out may be P. SIMD = false
+// runs the same loops without intrinsics.
+template <int N, int W, typename T, bool SIMD = true>
+inline void propagateCovariance(const T (*F)[W], const T (*P)[W], const T (*Q)[W], T q,
+    T (*FP)[W], T (*Ft)[W], T (*out)[W])
+{
+    for (int i = 0; i < N; i++)
+    {
+        for (int j = 0; j < N; j++) Ft[j][i] = F[i][j];
+    }
+    for (int i = 0; i < N; i++)
+    {
+        if (SIMD) simdScale<W>(FP[i], F[i][0], P[0]);
+        else scalarScale<W>(FP[i], F[i][0], P[0]);
+        for (int k = 1; k < N; k++)
+        {
+            if (SIMD) simdAxpy<W>(FP[i], F[i][k], P[k]);
+            else scalarAxpy<W>(FP[i], F[i][k], P[k]);
+        }
+    }
+    for (int i = 0; i < N; i++)
+    {
+        if (SIMD) simdScale<W>(out[i], q, Q[i]);
+        else scalarScale<W>(out[i], q, Q[i]);
+        for (int k = 0; k < N; k++)
+        {
+            if (SIMD) simdAxpy<W>(out[i], FP[i][k], Ft[k]);
+            else scalarAxpy<W>(out[i], FP[i][k], Ft[k]);
+        }
+    }
+}
@@ -0,0 +1,341 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: NavEKF_tune.cpp                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#include "NavEKF_tune.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+NoiseTuner::NoiseTuner():
+autodiff_jacobian(false),
+H(rc_matrix_empty()),
+nominal_dt(1),
+event_fusion(false),
+sequential(false),
+factorized(false),
+adapt_window(0),
+adapt_min(1),
+adapt_max(1),
+gate(0),
+gate_limit(0),
+score_method(score_nis),
+n(0),
+m(0),
+sorted(true)
+{
+}
+
+NoiseTuner::~NoiseTuner()
+{
+    clearLanes();
+    rc_matrix_free(&H);
+}
+
+void NoiseTuner::clearLanes()
+{
+    for (auto lane : lanes)
+    {
+        delete lane->state;
+        delete lane->filter;
+        rc_matrix_free(&lane->Q);
+        rc_matrix_free(&lane->R);
+        rc_matrix_free(&lane->Pi);
+        rc_vector_free(&lane->y);
+        delete lane;
+    }
+    lanes.clear();
+}
+
+bool NoiseTuner::init(const string &name, bool autodiff, const rc_matrix_t &H_in,
+    double time_step, bool event)
+{
+    clearLanes();
+    MotionModel *model = createMotionModel(name, autodiff);
+    if (!model) return false;
+    n = model->getStateCount();
+    m = H_in.rows;
+    if ((H_in.cols != n) || (m < 1) || (m > max_inputs) || !(time_step > 0))
+    {
+        delete model;
+        return false;
+    }
+    // Headings, and the inputs that measure one directly, are compared
+    // the short way round, as the filter does
+    axis_wrap.assign(n, 0);
+    for (int i = 0; i < n; i++) axis_wrap[i] = model->wrapsAxis(i);
+    delete model;
+    row_wrap.assign(m, 0);
+    for (int a = 0; a < m; a++)
+    {
+        int nonzero = 0;
+        for (int i = 0; i < n; i++)
+        {
+            if (H_in.d[a][i] == 0) continue;
+            nonzero++;
+            row_wrap[a] = (H_in.d[a][i] == 1) && axis_wrap[i];
+        }
+        if (nonzero != 1) row_wrap[a] = 0;
+    }
+    FixedEKFBase *probe = newFixedEKF<max_inputs, cov_real_t>(n);
+    if (!probe) return false;
+    delete probe;
+    model_name = name;
+    autodiff_jacobian = autodiff;
+    rc_matrix_duplicate(H_in, &H);
+    nominal_dt = time_step;
+    event_fusion = event;
+    q_weights.assign(n, 1);
+    r_weights.assign(m, 1);
+    timeouts.assign(m, 0);
+    return true;
+}
+
+bool NoiseTuner::setNoiseWeights(const vector<double> &q_in, const vector<double> &r_in)
+{
+    if (((int)q_in.size() != n) || ((int)r_in.size() != m)) return false;
+    q_weights = q_in;
+    r_weights = r_in;
+    return true;
+}
+
+bool NoiseTuner::setTimeouts(const vector<double> &timeouts_in)
+{
+    if ((int)timeouts_in.size() != m) return false;
+    timeouts = timeouts_in;
+    return true;
+}
+
+void NoiseTuner::addSample(double time, int slot, double value)
+{
+    samples.push_back({time, value, slot});
+    sorted = false;
+}
+
+void NoiseTuner::addReference(double time, int axis, double value)
+{
+    references.push_back({time, value, axis});
+    sorted = false;
+}
+
+void NoiseTuner::sortSamples()
+{
+    if (sorted) return;
+    auto by_time = [](const sensor_sample_t &a, const sensor_sample_t &b) {return (a.time < b.time);};
+    // stable, so simultaneous samples keep the order they were logged in
+    stable_sort(samples.begin(), samples.end(), by_time);
+    stable_sort(references.begin(), references.end(), by_time);
+    sorted = true;
+}
+
+void NoiseTuner::addLanes(int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        lane_t *lane = new lane_t;
+        lane->state = new NavState2D(H, nominal_dt, createMotionModel(model_name, autodiff_jacobian));
+        lane->filter = newFixedEKF<max_inputs, cov_real_t>(n);
+        lane->Q = rc_matrix_empty();
+        lane->R = rc_matrix_empty();
+        lane->Pi = rc_matrix_empty();
+        lane->y = rc_vector_empty();
+        rc_matrix_identity(&lane->Q, n);
+        rc_matrix_identity(&lane->R, m);
+        rc_matrix_identity(&lane->Pi, n);
+        rc_vector_zeros(&lane->y, m);
+        lane->P.assign(n * n, 0);
+        lane->rows.assign(m, 0);
+        lane->last.assign(m, 0);
+        lanes.push_back(lane);
+    }
+}
+
+tune_result_t NoiseTuner::evaluate(double proc_noise, double meas_noise)
+{
+    tune_result_t result;
+    result.proc_noise = proc_noise;
+    result.meas_noise = meas_noise;
+    sortSamples();
+    if (lanes.empty()) addLanes(1);
+    evaluate(*lanes[0], result);
+    return result;
+}
+
+vector<tune_result_t> NoiseTuner::sweep(const vector<pair<double, double>> &settings, int threads)
+{
+    const int count = settings.size();
+    vector<tune_result_t> results(count);
+    for (int c = 0; c < count; c++)
+    {
+        results[c].proc_noise = settings[c].first;
+        results[c].meas_noise = settings[c].second;
+    }
+    if (settings.empty()) return results;
+    sortSamples();
+    threads = max(1, min(threads, count));
+    const int lane_count = lanes.size();
+    if (lane_count < threads) addLanes(threads - lane_count);
+    // Every setting costs about the same, so striding them across the
+    // threads balances well enough without a shared work queue
+    WorkerPool pool(threads);
+    pool.run(threads, [&](int t) {
+        for (int c = t; c < count; c += threads) evaluate(*lanes[t], results[c]);
+    });
+    return results;
+}
+
+int NoiseTuner::best(const vector<tune_result_t> &results)
+{
+    const int count = results.size();
+    int index = -1;
+    for (int c = 0; c < count; c++)
+    {
+        if ((index < 0) || (results[c].score < results[index].score)) index = c;
+    }
+    return index;
+}
+
+vector<double> NoiseTuner::logSpace(double lo, double hi, int count)
+{
+    vector<double> values;
+    if (count == 1) values.push_back(sqrt(lo * hi));
+    for (int i = 0; (count > 1) && (i < count); i++)
+    {
+        values.push_back(lo * pow(hi / lo, (double)i / (count - 1)));
+    }
+    return values;
+}
+
+// One replay of the samples with the noise settings in result
+void NoiseTuner::evaluate(lane_t &lane, tune_result_t &result)
+{
+    const double worst = numeric_limits<double>::infinity();
+    result.nis = 0;
+    result.rms_error = 0;
+    result.score = worst;
+    result.updates = 0;
+    result.failures = 0;
+    for (int i = 0; i < n; i++) lane.Q.d[i][i] = result.proc_noise * q_weights[i];
+    for (int a = 0; a < m; a++) lane.R.d[a][a] = result.meas_noise * r_weights[a];
+    if (!lane.filter->init(lane.Q, lane.R, lane.Pi)) return;
+    lane.filter->setSequential(sequential);
+    lane.filter->setSelection(H);
+    lane.filter->setWrapAxes(lane.state->getWrapAxes());
+    if (!lane.filter->setFactorized(factorized)) return;
+    if (!lane.filter->setAdaptive(adapt_window, adapt_min, adapt_max)) return;
+    if (!lane.filter->setGate(gate, gate_limit)) return;
+    for (int a = 0; a < m; a++)
+    {
+        lane.y.d[a] = 0;
+        lane.last[a] = -numeric_limits<double>::infinity();
+    }
+    double nis_sum = 0;
+    uint64_t nis_count = 0;
+    double err_sum = 0;
+    uint64_t err_count = 0;
+    size_t next_ref = 0;
+    if (!samples.empty())
+    {
+        double last = samples[0].time;
+        if (event_fusion)
+        {
+            // As NavEKF::fuseSample(), with no step before the first sample
+            for (auto &sample : samples)
+            {
+                scoreReferences(lane, sample.time, last, next_ref, err_sum, err_count);
+                lane.y.d[sample.slot] = sample.value;
+                lane.rows[0] = sample.slot;
+                stepLane(lane, max(sample.time - last, 0.0), 1, result, nis_sum, nis_count);
+                last = max(last, sample.time);
+            }
+        }
+        else
+        {
+            // As NavEKF::tickFilter() run from the log by NavReplay, with
+            // mail up to each tick delivered first. A tick with no input
+            // in its timeout is skipped, and the next predicts across it.
+            size_t next = 0;
+            for (uint64_t k = 0; next < samples.size(); k++)
+            {
+                const double now = samples[0].time + (k * nominal_dt);
+                for (; (next < samples.size()) && (samples[next].time <= now); next++)
+                {
+                    lane.y.d[samples[next].slot] = samples[next].value;
+                    lane.last[samples[next].slot] = samples[next].time;
+                }
+                int row_count = 0;
+                for (int a = 0; a < m; a++)
+                {
+                    if (!isfinite(lane.last[a])) continue;
+                    if ((timeouts[a] == 0) || ((now - lane.last[a]) <= timeouts[a])) lane.rows[row_count++] = a;
+                }
+                if (row_count == 0) continue;
+                scoreReferences(lane, now, last, next_ref, err_sum, err_count);
+                stepLane(lane, (k == 0) ? nominal_dt : (now - last), row_count, result, nis_sum, nis_count);
+                last = now;
+            }
+        }
+    }
+    if (nis_count > 0) result.nis = nis_sum / nis_count;
+    if (err_count > 0) result.rms_error = sqrt(err_sum / err_count);
+    if (score_method == score_nis)
+    {
+        if (nis_count > 0) result.score = fabs(log(result.nis));
+    }
+    else if (err_count > 0)
+    {
+        result.score = result.rms_error;
+    }
+    // a diverged filter can score NaN, which would never compare as worse
+    if (!isfinite(result.score)) result.score = worst;
+}
+
+// Predict by dt and fuse the first row_count of lane.rows, adding the
+// NIS of each measurement against the predicted covariance
+void NoiseTuner::stepLane(lane_t &lane, double dt, int row_count, tune_result_t &result,
+    double &nis_sum, uint64_t &nis_count)
+{
+    rc_vector_t x = lane.filter->estimateVector();
+    lane.state->tick(&x, dt);
+    lane.filter->predict(lane.state->getF(), lane.state->getXPrediction(), dt / nominal_dt);
+    if (row_count == 0) return;
+    const rc_vector_t &h = lane.state->getYPrediction();
+    lane.filter->getCovariance(lane.P.data());
+    for (int r = 0; r < row_count; r++)
+    {
+        const int a = lane.rows[r];
+        const double *h_row = H.d[a];
+        double s = lane.R.d[a][a] * lane.filter->getNoiseScale(a);
+        for (int i = 0; i < n; i++)
+        {
+            if (h_row[i] == 0) continue;
+            for (int j = 0; j < n; j++) s += h_row[i] * lane.P[(i * n) + j] * h_row[j];
+        }
+        double z = lane.y.d[a] - h.d[a];
+        if (row_wrap[a]) z = headingDifference(z);
+        nis_sum += (z * z) / s;
+        nis_count++;
+    }
+    if (!lane.filter->correct(H, lane.y, h, lane.rows.data(), row_count)) result.failures++;
+    result.updates++;
+}
+
+// Squared error of every reference up to until, against the estimate
+// predicted from last to the reference's own time
+void NoiseTuner::scoreReferences(lane_t &lane, double until, double last, size_t &next,
+    double &err_sum, uint64_t &err_count)
+{
+    for (; (next < references.size()) && (references[next].time <= until); next++)
+    {
+        const sensor_sample_t &ref = references[next];
+        rc_vector_t x = lane.filter->estimateVector();
+        lane.state->tick(&x, max(ref.time - last, 0.0));
+        double err = lane.state->getXPrediction().d[ref.slot] - ref.value;
+        if (axis_wrap[ref.slot]) err = headingDifference(err);
+        err_sum += err * err;
+        err_count++;
+    }
+}
@@ -0,0 +1,148 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: NavEKF_tune.h                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include "NavEKF_model.h"
+#include "NavEKF_fixed.h"
+#include "NavEKF_increment.h"
+#include "NavEKF_buffer.h"
+#include "NavEKF_bank.h"
+
+extern "C" {
+    #include "roboticscape.h"
+}
+
+using namespace std;
+
+enum tune_score_t : uint8_t {
+    score_nis       = 0,    // distance of the mean NIS from 1
+    score_error     = 1     // RMS error against a reference track
+};
+
+// One PROCESS_NOISE / MEASUREMENT_NOISE pair and how the filter did with it
+struct tune_result_t {
+    double proc_noise;
+    double meas_noise;
+    double nis;             // mean normalized innovation squared, per measurement
+    double rms_error;       // against the reference track, if there is one
+    double score;           // lower is better
+    uint64_t updates;
+    uint64_t failures;
+};
+
+// Replays a recorded set of input samples through the filter for many
+// noise settings, to find the pair that suits the data best. The filter
+// is set up as NavEKF's fixed engine would be, with Q = proc_noise*I and
+// R = meas_noise*I, each scaled per axis and per input by the weights
+// given to setNoiseWeights(), and fuses the samples as its fusion mode would: each
+// at its own time in event mode, or the newest of every input that has
+// reported within its timeout once per nominal step in tick mode.
+//
+// Each setting is scored on the consistency of its innovations, or on
+// its error against reference samples of the true state, if the log has
+// them. The NIS is taken one measurement at a time, z^2 / (h*P*h^T + r),
+// so a consistent filter averages 1 whatever the number of inputs.
+//
+// sweep() runs the settings across a WorkerPool. Every thread has its
+// own filter and state, built before the sweep starts, so each replay
+// runs without touching the heap and the sweep scales with cores.
+class NoiseTuner
+{
+public:
+    NoiseTuner();
+    ~NoiseTuner();
+
+    // H maps the model's states to the inputs, and time_step is the
+    // nominal AppTick step that Q is specified over
+    bool init(const string &model_name, bool autodiff_jacobian, const rc_matrix_t &H,
+        double time_step, bool event_fusion);
+    void setSequential(bool enable) {sequential = enable;};
+    void setFactorized(bool enable) {factorized = enable;};
+    // As FixedEKF::setAdaptive(), applied to every replay
+    void setAdaptive(int window, double min_scale, double max_scale)
+        {adapt_window = window; adapt_min = min_scale; adapt_max = max_scale;};
+    void setGate(double threshold, int limit) {gate = threshold; gate_limit = limit;};
+    void setScore(tune_score_t method) {score_method = method;};
+    // Diagonals of Q and R relative to proc_noise and meas_noise, so that
+    // a sweep keeps the ratios between axes and between inputs. Both are
+    // all ones after init(). Returns false if either is the wrong size.
+    bool setNoiseWeights(const vector<double> &q_weights, const vector<double> &r_weights);
+    // Seconds each input is fused for after its last sample in tick mode,
+    // 0 for as long as it's held, as NavEKF's INPUT_TIMEOUT. All 0 after
+    // init(). Returns false if it's the wrong size.
+    bool setTimeouts(const vector<double> &timeouts);
+
+    // Samples may be added in any order; they're sorted by time on first use
+    void addSample(double time, int slot, double value);
+    // A reference value of a state axis, e.g. from a survey-grade fix
+    void addReference(double time, int axis, double value);
+
+    int getStateCount() const {return n;};
+    int getSampleCount() const {return samples.size();};
+    int getReferenceCount() const {return references.size();};
+
+    tune_result_t evaluate(double proc_noise, double meas_noise);
+    // Evaluate every (proc_noise, meas_noise) pair on up to threads
+    // threads, returning the results in the same order
+    vector<tune_result_t> sweep(const vector<pair<double, double>> &settings, int threads);
+    // Index of the lowest score
+    static int best(const vector<tune_result_t> &results);
+    // count values from lo to hi, evenly spaced in log, for a grid of
+    // noise settings that can span several orders of magnitude
+    static vector<double> logSpace(double lo, double hi, int count);
+
+private:
+    // Everything one replay needs, owned by one thread
+    struct lane_t {
+        NavState2D *state;
+        FixedEKFBase *filter;
+        rc_matrix_t Q;
+        rc_matrix_t R;
+        rc_matrix_t Pi;
+        rc_vector_t y;
+        vector<double> P;
+        vector<int> rows;
+        vector<double> last;    // newest sample time of each input
+    };
+
+    string model_name;
+    bool autodiff_jacobian;
+    rc_matrix_t H;
+    double nominal_dt;
+    bool event_fusion;
+    bool sequential;
+    bool factorized;
+    int adapt_window;
+    double adapt_min;
+    double adapt_max;
+    double gate;
+    int gate_limit;
+    tune_score_t score_method;
+    int n;
+    int m;
+    vector<double> q_weights;
+    vector<double> r_weights;
+    vector<double> timeouts;
+    vector<uint8_t> axis_wrap;      // headings
+    vector<uint8_t> row_wrap;       // inputs that select a heading
+    vector<sensor_sample_t> samples;
+    vector<sensor_sample_t> references;     // slot is the state axis
+    bool sorted;
+    vector<lane_t *> lanes;
+
+    void sortSamples();
+    void addLanes(int count);
+    void clearLanes();
+    void evaluate(lane_t &lane, tune_result_t &result);
+    void stepLane(lane_t &lane, double dt, int row_count, tune_result_t &result,
+        double &nis_sum, uint64_t &nis_count);
+    void scoreReferences(lane_t &lane, double until, double last, size_t &next,
+        double &err_sum, uint64_t &err_count);
+};
@@ -0,0 +1,100 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: replay_main.cpp                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include "MBUtils.h"
+#include "NavEKF_replay.h"
+
+using namespace std;
+
+void showReplayHelpAndExit()
+{
+  cout << "Usage: pNavEKF_Replay file.moos file.alog [OPTIONS]" << endl;
+  cout << endl;
+  cout << "Runs pNavEKF over a logged mission as fast as the CPU allows, using" << endl;
+  cout << "the pNavEKF block of file.moos and the INPUT variables in file.alog." << endl;
+  cout << endl;
+  cout << "Options:" << endl;
+  cout << "  --alias=<ProcessName>    Read this block of file.moos rather than pNavEKF" << endl;
+  cout << "  --out=<file>             Write the estimates here rather than to stdout" << endl;
+  cout << "  --format=csv|binary      One CSV row per filter step (the default), or" << endl;
+  cout << "                           NavEKF_codec.h messages back to back" << endl;
+  cout << "  --help, -h               Display this help message" << endl;
+  exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+  string mission_file;
+  string alog_file;
+  string out_file;
+  string app_name = "pNavEKF";
+  replay_format_t format = replay_csv;
+
+  for(int i=1; i<argc; i++) {
+    string argi = argv[i];
+    if((argi == "-h") || (argi == "--help") || (argi=="-help"))
+      showReplayHelpAndExit();
+    else if(strEnds(argi, ".moos") || strEnds(argi, ".moos++"))
+      mission_file = argi;
+    else if(strEnds(argi, ".alog"))
+      alog_file = argi;
+    else if(strBegins(argi, "--alias="))
+      app_name = argi.substr(8);
+    else if(strBegins(argi, "--out="))
+      out_file = argi.substr(6);
+    else if(argi == "--format=csv")
+      format = replay_csv;
+    else if(argi == "--format=binary")
+      format = replay_binary;
+    else {
+      cerr << "Unknown option: " << argi << endl;
+      return(1);
+    }
+  }
+
+  if((mission_file == "") || (alog_file == ""))
+    showReplayHelpAndExit();
+
+  ifstream alog(alog_file);
+  if(!alog) {
+    cerr << "Could not open " << alog_file << endl;
+    return(1);
+  }
+  ofstream out_stream;
+  if(out_file != "") {
+    out_stream.open(out_file, ios::binary);
+    if(!out_stream) {
+      cerr << "Could not open " << out_file << endl;
+      return(1);
+    }
+  }
+  ostream &out = (out_file != "") ? out_stream : cout;
+
+  NavReplay replay;
+  bool configured = replay.configure(mission_file, app_name);
+  for(auto &warning : replay.getConfigWarnings())
+    cerr << "Config warning: " << warning << endl;
+  if(!configured) {
+    cerr << "Could not configure " << app_name << " from " << mission_file << endl;
+    return(1);
+  }
+
+  auto start = chrono::steady_clock::now();
+  bool ok = replay.run(alog, out, format);
+  double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  cerr << replay.getMessageCount() << " inputs, " << replay.getRecordCount() << " steps, "
+       << replay.getLogDuration() << " s of log replayed in " << wall << " s" << endl;
+  if(!ok) {
+    cerr << "Error writing the estimates" << endl;
+    return(1);
+  }
+  return(0);
+}
@@ -0,0 +1,75 @@
+#include "../NavEKF_alog.h"
+#include "gtest/gtest.h"
+#include <sstream>
+
+TEST(AlogReaderTest, records_test)
+{
+    istringstream log(
+        "%% LOGFILE:       /home/mission/mission.alog\n"
+        "%% LOGSTART           1700000000.25\n"
+        "%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%\n"
+        "\n"
+        "0.125   NAV_X        uSimMarine   12.5\n"
+        "0.250\tNAV_HEADING\tuSimMarine\t-45\r\n"
+        "0.375   DEPLOY       pHelmIvP     true\n"
+        "0.500   VIEW_POINT   pMarineViewer  x=1, y=2, label=a b  \n"
+        "0.625   NAV_SPEED    uSimMarine   2.5e-1\n");
+    AlogReader reader(log);
+    alog_entry_t entry;
+
+    ASSERT_TRUE(reader.next(entry));
+    EXPECT_DOUBLE_EQ(reader.getLogStart(), 1700000000.25);
+    EXPECT_DOUBLE_EQ(entry.time, 0.125);
+    EXPECT_EQ(entry.var, "NAV_X");
+    EXPECT_EQ(entry.source, "uSimMarine");
+    EXPECT_TRUE(entry.numeric);
+    EXPECT_DOUBLE_EQ(entry.number, 12.5);
+
+    // tab separated, with a Windows line ending
+    ASSERT_TRUE(reader.next(entry));
+    EXPECT_EQ(entry.var, "NAV_HEADING");
+    EXPECT_TRUE(entry.numeric);
+    EXPECT_DOUBLE_EQ(entry.number, -45);
+
+    ASSERT_TRUE(reader.next(entry));
+    EXPECT_EQ(entry.var, "DEPLOY");
+    EXPECT_FALSE(entry.numeric);
+    EXPECT_EQ(entry.value, "true");
+
+    // string values run to the end of the line, less trailing blanks
+    ASSERT_TRUE(reader.next(entry));
+    EXPECT_FALSE(entry.numeric);
+    EXPECT_EQ(entry.value, "x=1, y=2, label=a b");
+
+    ASSERT_TRUE(reader.next(entry));
+    EXPECT_TRUE(entry.numeric);
+    EXPECT_DOUBLE_EQ(entry.number, 0.25);
+
+    EXPECT_FALSE(reader.next(entry));
+    EXPECT_EQ(reader.getLineCount(), 9);
+}
+
+TEST(AlogReaderTest, malformed_test)
+{
+    AlogReader reader(cin);
+    alog_entry_t entry;
+    EXPECT_FALSE(reader.parseLine("", entry));
+    EXPECT_FALSE(reader.parseLine("   ", entry));
+    EXPECT_FALSE(reader.parseLine("% comment", entry));
+    EXPECT_FALSE(reader.parseLine("12.5", entry));
+    EXPECT_FALSE(reader.parseLine("12.5 NAV_X", entry));
+    EXPECT_FALSE(reader.parseLine("NAV_X uSimMarine 12.5", entry));
+    EXPECT_FALSE(reader.parseLine("12.5x NAV_X uSimMarine 1", entry));
+    // a record with an empty value is still a record, just not a number
+    ASSERT_TRUE(reader.parseLine("12.5 NAV_X uSimMarine", entry));
+    EXPECT_FALSE(entry.numeric);
+    EXPECT_EQ(entry.value, "");
+    // a number with trailing text isn't one
+    ASSERT_TRUE(reader.parseLine("12.5 NAV_X uSimMarine 3 m", entry));
+    EXPECT_FALSE(entry.numeric);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,243 @@
+#include "../NavEKF_bank.h"
+#include "../NavEKF_increment.h"
+#include "gtest/gtest.h"
+#include <random>
+#include <atomic>
+#include <chrono>
+
+extern "C" {
+    #include "roboticscape.h"
+}
+
+#define STDTOL              (1e-9)
+#define STDTS               (0.1)
+#define STEP_COUNT          (100)
+#define PROC_NOISE          (0.01)
+#define MEAS_NOISE          (0.5)
+
+using namespace std;
+
+TEST(WorkerPoolTest, coverage_test)
+{
+    const int count = 1000;
+    atomic<int> hits[count];
+    WorkerPool pool(4);
+    EXPECT_EQ(pool.size(), 4);
+    for (auto &h : hits) h = 0;
+    for (int round = 0; round < 50; round++)
+    {
+        pool.run(count, [&](int i) {hits[i]++;});
+    }
+    for (auto &h : hits) EXPECT_EQ(h.load(), 50);
+    // fewer indices than threads
+    for (auto &h : hits) h = 0;
+    pool.run(2, [&](int i) {hits[i]++;});
+    EXPECT_EQ(hits[0].load(), 1);
+    EXPECT_EQ(hits[1].load(), 1);
+    EXPECT_EQ(hits[2].load(), 0);
+}
+
+// Runs a bank against separate filters built the way NavEKF builds one
+class FilterBankTestFramework : public ::testing::Test
+{
+    protected:
+    void SetUp ()
+    {
+        re.seed(chrono::system_clock::now().time_since_epoch().count());
+        H = rc_matrix_empty();
+        Q = rc_matrix_empty();
+        R = rc_matrix_empty();
+        Pi = rc_matrix_empty();
+    }
+
+    void TearDown()
+    {
+        rc_matrix_free(&H);
+        rc_matrix_free(&Q);
+        rc_matrix_free(&R);
+        rc_matrix_free(&Pi);
+    }
+
+    // Observe the first input_count axes of an n-state model
+    void buildMatrices(int n, int input_count)
+    {
+        rc_matrix_zeros(&H, input_count, n);
+        for (int i = 0; i < input_count; i++) H.d[i][i % n] = 1;
+        rc_matrix_identity(&Q, n);
+        rc_matrix_identity(&R, input_count);
+        rc_matrix_identity(&Pi, n);
+        rc_matrix_times_scalar(&Q, PROC_NOISE);
+        rc_matrix_times_scalar(&R, MEAS_NOISE);
+    }
+
+    default_random_engine re;
+    rc_matrix_t H;
+    rc_matrix_t Q;
+    rc_matrix_t R;
+    rc_matrix_t Pi;
+};
+
+TEST_F(FilterBankTestFramework, matches_single_filters_test)
+{
+    const int vehicles = 3;
+    uniform_real_distribution<double> noise(-1.0, 1.0);
+    for (const char *name : {"CV", "CTRV", "CTRA", "3D"})
+    {
+        MotionModel *model = createMotionModel(name, false);
+        const int n = model->getStateCount();
+        const int inputs = n;
+        buildMatrices(n, inputs);
+        FilterBank bank;
+        ASSERT_TRUE(bank.init(model, vehicles, H, Q, R, Pi, 1));
+        EXPECT_EQ(bank.getThreadCount(), 1);
+        EXPECT_EQ(bank.getStateCount(), n);
+        vector<NavState2D *> states;
+        vector<FixedEKFBase *> filters;
+        for (int v = 0; v < vehicles; v++)
+        {
+            states.push_back(new NavState2D(H, STDTS, createMotionModel(name, false)));
+            filters.push_back(newFixedEKF<max_inputs, cov_real_t>(n));
+            ASSERT_TRUE(filters[v]->init(Q, R, Pi));
+            // headings wrap as they do in the bank
+            filters[v]->setSelection(H);
+            filters[v]->setWrapAxes(states[v]->getWrapAxes());
+        }
+        vector<double> y(vehicles * inputs);
+        vector<double> P_bank(n * n);
+        vector<double> P_ref(n * n);
+        rc_vector_t x_last = rc_vector_empty();
+        rc_vector_t y_v = rc_vector_empty();
+        rc_vector_zeros(&x_last, n);
+        rc_vector_zeros(&y_v, inputs);
+        for (int step = 0; step < STEP_COUNT; step++)
+        {
+            for (int k = 0; k < (int)y.size(); k++) y[k] = (step * 0.1 * (1 + (k / inputs))) + noise(re);
+            EXPECT_EQ(bank.step(y.data(), STDTS, 1), 0);
+            for (int v = 0; v < vehicles; v++)
+            {
+                for (int i = 0; i < n; i++) x_last.d[i] = filters[v]->getEstimate()[i];
+                for (int a = 0; a < inputs; a++) y_v.d[a] = y[(v * inputs) + a];
+                states[v]->tick(&x_last);
+                ASSERT_TRUE(filters[v]->predict(states[v]->getF(), states[v]->getXPrediction()));
+                ASSERT_TRUE(filters[v]->correct(states[v]->getH(), y_v, states[v]->getYPrediction()));
+                bank.getFilter(v).getCovariance(P_bank.data());
+                filters[v]->getCovariance(P_ref.data());
+                for (int i = 0; i < n; i++)
+                {
+                    EXPECT_NEAR(bank.getState(v, i), filters[v]->getEstimate()[i], STDTOL) << name;
+                }
+                for (int k = 0; k < (n * n); k++) EXPECT_NEAR(P_bank[k], P_ref[k], STDTOL) << name;
+            }
+        }
+        for (int v = 0; v < vehicles; v++)
+        {
+            delete states[v];
+            delete filters[v];
+        }
+        rc_vector_free(&x_last);
+        rc_vector_free(&y_v);
+    }
+}
+
+// Only the inputs flagged active are fused, and a vehicle with none is
+// only predicted, as a single filter fusing those rows would be
+TEST_F(FilterBankTestFramework, active_inputs_test)
+{
+    const int vehicles = 3;
+    const int inputs = 4;
+    uniform_real_distribution<double> noise(-1.0, 1.0);
+    buildMatrices(state_count, inputs);
+    FilterBank bank;
+    ASSERT_TRUE(bank.init(createMotionModel("CTRA", false), vehicles, H, Q, R, Pi, 1));
+    NavState2D state(H, STDTS, createMotionModel("CTRA", false));
+    vector<FixedEKFBase *> filters;
+    for (int v = 0; v < vehicles; v++)
+    {
+        filters.push_back(newFixedEKF<max_inputs, cov_real_t>(state_count));
+        ASSERT_TRUE(filters[v]->init(Q, R, Pi));
+        filters[v]->setSelection(H);
+        filters[v]->setWrapAxes(state.getWrapAxes());
+    }
+    // All inputs, the first and third, and none
+    const uint8_t active[vehicles * inputs] = {1, 1, 1, 1, 1, 0, 1, 0, 0, 0, 0, 0};
+    const int rows[] = {0, 2};
+    const int row_counts[] = {inputs, 2, 0};
+    vector<double> y(vehicles * inputs);
+    rc_vector_t x_last = rc_vector_empty();
+    rc_vector_t y_v = rc_vector_empty();
+    rc_vector_zeros(&x_last, state_count);
+    rc_vector_zeros(&y_v, inputs);
+    for (int step = 0; step < STEP_COUNT; step++)
+    {
+        for (auto &value : y) value = (step * 0.1) + noise(re);
+        EXPECT_EQ(bank.step(y.data(), STDTS, 1, active), 0);
+        for (int v = 0; v < vehicles; v++)
+        {
+            for (int i = 0; i < state_count; i++) x_last.d[i] = filters[v]->getEstimate()[i];
+            for (int a = 0; a < inputs; a++) y_v.d[a] = y[(v * inputs) + a];
+            state.tick(&x_last);
+            ASSERT_TRUE(filters[v]->predict(state.getF(), state.getXPrediction()));
+            if (row_counts[v] == inputs)
+            {
+                ASSERT_TRUE(filters[v]->correct(state.getH(), y_v, state.getYPrediction()));
+            }
+            else if (row_counts[v] > 0)
+            {
+                ASSERT_TRUE(filters[v]->correct(state.getH(), y_v, state.getYPrediction(), rows, row_counts[v]));
+            }
+            for (int i = 0; i < state_count; i++)
+            {
+                EXPECT_NEAR(bank.getState(v, i), filters[v]->getEstimate()[i], STDTOL) << v;
+            }
+        }
+    }
+    // The vehicle with nothing to fuse has only been predicted
+    EXPECT_EQ(bank.getFilter(2).getStep(), 0);
+    EXPECT_EQ(bank.getFilter(0).getStep(), STEP_COUNT);
+    for (auto f : filters) delete f;
+    rc_vector_free(&x_last);
+    rc_vector_free(&y_v);
+}
+
+// Spreading the updates across threads mustn't change the answer
+TEST_F(FilterBankTestFramework, threaded_test)
+{
+    const int vehicles = 64;
+    const int inputs = 4;
+    uniform_real_distribution<double> noise(-1.0, 1.0);
+    buildMatrices(state_count, inputs);
+    FilterBank serial;
+    FilterBank threaded;
+    ASSERT_TRUE(serial.init(createMotionModel("CTRA", false), vehicles, H, Q, R, Pi, 1));
+    ASSERT_TRUE(threaded.init(createMotionModel("CTRA", false), vehicles, H, Q, R, Pi, 4));
+    EXPECT_EQ(threaded.getThreadCount(), 4);
+    vector<double> y(vehicles * inputs);
+    for (int step = 0; step < STEP_COUNT; step++)
+    {
+        for (auto &value : y) value = (step * 0.1) + noise(re);
+        EXPECT_EQ(serial.step(y.data(), STDTS, 1), 0);
+        EXPECT_EQ(threaded.step(y.data(), STDTS, 1), 0);
+    }
+    for (int v = 0; v < vehicles; v++)
+    {
+        for (int i = 0; i < state_count; i++)
+        {
+            EXPECT_DOUBLE_EQ(serial.getState(v, i), threaded.getState(v, i));
+        }
+        EXPECT_EQ(threaded.getFilter(v).getStep(), STEP_COUNT);
+    }
+}
+
+TEST_F(FilterBankTestFramework, size_check_test)
+{
+    FilterBank bank;
+    buildMatrices(state_count, 4);
+    EXPECT_FALSE(bank.init(createMotionModel("CV", false), 2, H, Q, R, Pi, 1));
+    EXPECT_FALSE(bank.init(createMotionModel("CTRA", false), 0, H, Q, R, Pi, 1));
+    EXPECT_TRUE(bank.init(createMotionModel("CTRA", false), 2, H, Q, R, Pi, 1));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,761 @@
+#include "../NavEKF_fixed.h"
+#include "../NavEKF_increment.h"
+#include "gtest/gtest.h"
+#include <random>
+#include <cmath>
+#include <iostream>
+#include <chrono>
+
+extern "C" {
+    #include "roboticscape.h"
+}
+
+#define STDTOL              (1e-6)
+#define STDTS               (0.1)
+#define STEP_COUNT          (200)
+#define PROC_NOISE          (0.01)
+#define MEAS_NOISE          (0.5)
+#define FLOATTOL            (1e-3)
+
+// Runs FixedEKF and rc_kalman_update_ekf side by side on the same inputs
+class FixedEKFTestFramework : public ::testing::Test
+{
+    protected:
+    void SetUp ()
+    {
+        re.seed(chrono::system_clock::now().time_since_epoch().count());
+        sensor_matrix = rc_matrix_empty();
+        sensor_vector = rc_vector_empty();
+        rc_kf = rc_kalman_empty();
+        test_obj = nullptr;
+    }
+
+    void TearDown()
+    {
+        if (test_obj) delete test_obj;
+        rc_kalman_free(&rc_kf);
+        rc_matrix_free(&sensor_matrix);
+        rc_vector_free(&sensor_vector);
+    }
+
+    // Build a sensor matrix that observes the given axes, in order. R is
+    // MEAS_NOISE*I unless the variance of each input is given.
+    void buildFilters(const vector<state_axis_t> &axes, const vector<double> &variances = {})
+    {
+        rc_matrix_t Q = rc_matrix_empty();
+        rc_matrix_t R = rc_matrix_empty();
+        rc_matrix_t Pi = rc_matrix_empty();
+        rc_matrix_zeros(&sensor_matrix, axes.size(), state_count);
+        for (int i = 0; i < (int)axes.size(); i++) sensor_matrix.d[i][axes[i]] = 1;
+        rc_vector_zeros(&sensor_vector, axes.size());
+        rc_matrix_identity(&Q, state_count);
+        rc_matrix_identity(&R, axes.size());
+        rc_matrix_identity(&Pi, state_count);
+        rc_matrix_times_scalar(&Q, PROC_NOISE);
+        rc_matrix_times_scalar(&R, MEAS_NOISE);
+        for (int i = 0; i < (int)variances.size(); i++) R.d[i][i] = variances[i];
+        // and Q differs by axis along with it
+        for (int i = 0; (i < state_count) && !variances.empty(); i++) Q.d[i][i] = PROC_NOISE * (i + 1);
+        rc_kalman_alloc_ekf(&rc_kf, Q, R, Pi);
+        ASSERT_TRUE(fixed_kf.init(Q, R, Pi));
+        ASSERT_TRUE(float_kf.init(Q, R, Pi));
+        test_obj = new NavState2D(sensor_matrix, STDTS);
+        rc_matrix_free(&Q);
+        rc_matrix_free(&R);
+        rc_matrix_free(&Pi);
+    }
+
+    void runComparison()
+    {
+        compareFilter(fixed_kf, STDTOL);
+    }
+
+    template <typename T>
+    void compareFilter(FixedEKF<state_count, 16, T> &ekf, double tol)
+    {
+        uniform_real_distribution<double> noise(-1.0, 1.0);
+        rc_vector_t x_last = rc_vector_empty();
+        rc_vector_zeros(&x_last, state_count);
+        for (int step = 0; step < STEP_COUNT; step++)
+        {
+            for (int i = 0; i < sensor_vector.len; i++)
+            {
+                sensor_vector.d[i] = (step * 0.1) + noise(re);
+            }
+            // both filters must see the same prediction
+            for (int i = 0; i < state_count; i++) x_last.d[i] = ekf.x_est[i];
+            test_obj->tick(&x_last);
+            rc_kalman_update_ekf(&rc_kf, test_obj->getF(), test_obj->getH(),
+                test_obj->getXPrediction(), sensor_vector, test_obj->getYPrediction());
+            ASSERT_TRUE(ekf.update(test_obj->getF(), test_obj->getH(),
+                test_obj->getXPrediction(), sensor_vector, test_obj->getYPrediction()));
+            for (int i = 0; i < state_count; i++)
+            {
+                EXPECT_NEAR(ekf.x_est[i], rc_kf.x_est.d[i], tol);
+                for (int j = 0; j < state_count; j++)
+                {
+                    EXPECT_NEAR(ekf.P[i][j], rc_kf.P.d[i][j], tol);
+                }
+            }
+            // keep the two filters locked to the same trajectory
+            for (int i = 0; i < state_count; i++) rc_kf.x_est.d[i] = ekf.x_est[i];
+        }
+        EXPECT_EQ(ekf.step, rc_kf.step);
+        rc_vector_free(&x_last);
+    }
+
+    // Steps of a vehicle sitting still, observed with noise of standard
+    // deviation sigma in every input. Returns the largest noise scale.
+    double runStationary(double sigma, int steps)
+    {
+        normal_distribution<double> noise(0, sigma);
+        rc_vector_t x_last = rc_vector_empty();
+        rc_vector_zeros(&x_last, state_count);
+        double scale = 0;
+        for (int step = 0; step < steps; step++)
+        {
+            for (int i = 0; i < sensor_vector.len; i++) sensor_vector.d[i] = 10 + noise(re);
+            for (int i = 0; i < state_count; i++) x_last.d[i] = fixed_kf.x_est[i];
+            test_obj->tick(&x_last);
+            EXPECT_TRUE(fixed_kf.update(test_obj->getF(), test_obj->getH(),
+                test_obj->getXPrediction(), sensor_vector, test_obj->getYPrediction()));
+        }
+        for (int a = 0; a < sensor_vector.len; a++) scale = max(scale, fixed_kf.getNoiseScale(a));
+        rc_vector_free(&x_last);
+        return scale;
+    }
+
+    default_random_engine re;
+    NavState2D *test_obj;
+    FixedEKF<state_count, 16> fixed_kf;
+    FixedEKF<state_count, 16, float> float_kf;
+    rc_kalman_t rc_kf;
+    rc_matrix_t sensor_matrix;
+    rc_vector_t sensor_vector;
+};
+
+TEST_F(FixedEKFTestFramework, all_axes_test)
+{
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta,
+        state_axis_t::v, state_axis_t::theta_dot, state_axis_t::v_dot});
+    runComparison();
+}
+
+TEST_F(FixedEKFTestFramework, gps_only_test)
+{
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta, state_axis_t::v});
+    runComparison();
+}
+
+TEST_F(FixedEKFTestFramework, redundant_heading_test)
+{
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta,
+        state_axis_t::theta, state_axis_t::theta_dot, state_axis_t::v_dot});
+    runComparison();
+}
+
+// Scalar updates must reproduce the joint update for a diagonal R
+TEST_F(FixedEKFTestFramework, sequential_all_axes_test)
+{
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta,
+        state_axis_t::v, state_axis_t::theta_dot, state_axis_t::v_dot});
+    fixed_kf.setSequential(true);
+    ASSERT_TRUE(fixed_kf.isSequential());
+    runComparison();
+}
+
+TEST_F(FixedEKFTestFramework, sequential_redundant_heading_test)
+{
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta,
+        state_axis_t::theta, state_axis_t::theta_dot, state_axis_t::v_dot});
+    fixed_kf.setSequential(true);
+    ASSERT_TRUE(fixed_kf.isSequential());
+    runComparison();
+}
+
+// A noisy GPS alongside a tight gyro, each with its own variance
+TEST_F(FixedEKFTestFramework, per_input_noise_test)
+{
+    const vector<double> variances = {4, 4, 1, 0.25, 0.001, 0.05};
+    for (bool sequential : {false, true})
+    {
+        buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta,
+            state_axis_t::v, state_axis_t::theta_dot, state_axis_t::v_dot}, variances);
+        EXPECT_TRUE(fixed_kf.isDiagonalR());
+        ASSERT_TRUE(fixed_kf.setSelection(sensor_matrix));
+        fixed_kf.setSequential(sequential);
+        runComparison();
+        TearDown();
+        SetUp();
+    }
+}
+
+// Correlated inputs keep the dense R and the joint update
+TEST_F(FixedEKFTestFramework, correlated_noise_test)
+{
+    rc_matrix_t Q = rc_matrix_empty();
+    rc_matrix_t R = rc_matrix_empty();
+    rc_matrix_t Pi = rc_matrix_empty();
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta, state_axis_t::v});
+    rc_matrix_identity(&Q, state_count);
+    rc_matrix_identity(&R, 4);
+    rc_matrix_identity(&Pi, state_count);
+    rc_matrix_times_scalar(&Q, PROC_NOISE);
+    R.d[0][1] = 0.3;
+    R.d[1][0] = 0.3;
+    rc_kalman_free(&rc_kf);
+    rc_kalman_alloc_ekf(&rc_kf, Q, R, Pi);
+    ASSERT_TRUE(fixed_kf.init(Q, R, Pi));
+    EXPECT_FALSE(fixed_kf.isDiagonalR());
+    fixed_kf.setSequential(true);
+    EXPECT_FALSE(fixed_kf.isSequential());
+    EXPECT_FALSE(fixed_kf.setFactorized(true));
+    runComparison();
+    rc_matrix_free(&Q);
+    rc_matrix_free(&R);
+    rc_matrix_free(&Pi);
+}
+
+// The gather path for a selection H must match the dense products
+TEST_F(FixedEKFTestFramework, selection_joint_test)
+{
+    buildFilters({state_axis_t::y, state_axis_t::x, state_axis_t::v_dot,
+        state_axis_t::theta, state_axis_t::theta});
+    ASSERT_TRUE(fixed_kf.setSelection(sensor_matrix));
+    runComparison();
+}
+
+TEST_F(FixedEKFTestFramework, selection_sequential_test)
+{
+    buildFilters({state_axis_t::y, state_axis_t::x, state_axis_t::v_dot,
+        state_axis_t::theta, state_axis_t::theta});
+    ASSERT_TRUE(fixed_kf.setSelection(sensor_matrix));
+    fixed_kf.setSequential(true);
+    runComparison();
+}
+
+TEST_F(FixedEKFTestFramework, dense_fallback_test)
+{
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta, state_axis_t::v});
+    sensor_matrix.d[3][state_axis_t::v_dot] = 0.5;
+    EXPECT_FALSE(fixed_kf.setSelection(sensor_matrix));
+    EXPECT_FALSE(fixed_kf.isSelection());
+    delete test_obj;
+    test_obj = new NavState2D(sensor_matrix, STDTS);
+    runComparison();
+}
+
+// The U-D factored filter must track the plain covariance update
+TEST_F(FixedEKFTestFramework, factorized_all_axes_test)
+{
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta,
+        state_axis_t::v, state_axis_t::theta_dot, state_axis_t::v_dot});
+    ASSERT_TRUE(fixed_kf.setFactorized(true));
+    runComparison();
+    for (int i = 0; i < state_count; i++) EXPECT_GT(fixed_kf.D[i], 0);
+}
+
+TEST_F(FixedEKFTestFramework, factorized_selection_test)
+{
+    buildFilters({state_axis_t::y, state_axis_t::x, state_axis_t::v_dot,
+        state_axis_t::theta, state_axis_t::theta});
+    ASSERT_TRUE(fixed_kf.setSelection(sensor_matrix));
+    ASSERT_TRUE(fixed_kf.setFactorized(true));
+    runComparison();
+}
+
+TEST_F(FixedEKFTestFramework, factorized_dense_test)
+{
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta, state_axis_t::v});
+    sensor_matrix.d[3][state_axis_t::v_dot] = 0.5;
+    delete test_obj;
+    test_obj = new NavState2D(sensor_matrix, STDTS);
+    ASSERT_TRUE(fixed_kf.setFactorized(true));
+    runComparison();
+}
+
+// Fusing a subset of rows must match a filter built with only those rows
+TEST_F(FixedEKFTestFramework, partial_correct_test)
+{
+    FixedEKF<state_count, 16> subset_kf;
+    rc_matrix_t Q = rc_matrix_empty();
+    rc_matrix_t R = rc_matrix_empty();
+    rc_matrix_t Pi = rc_matrix_empty();
+    rc_matrix_t H_sub = rc_matrix_empty();
+    rc_vector_t y_sub = rc_vector_empty();
+    rc_vector_t h_sub = rc_vector_empty();
+    const int rows[] = {1, 3};
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta, state_axis_t::v});
+    rc_matrix_identity(&Q, state_count);
+    rc_matrix_identity(&R, 2);
+    rc_matrix_identity(&Pi, state_count);
+    rc_matrix_times_scalar(&Q, PROC_NOISE);
+    rc_matrix_times_scalar(&R, MEAS_NOISE);
+    ASSERT_TRUE(subset_kf.init(Q, R, Pi));
+    rc_matrix_zeros(&H_sub, 2, state_count);
+    H_sub.d[0][state_axis_t::y] = 1;
+    H_sub.d[1][state_axis_t::v] = 1;
+    rc_vector_zeros(&y_sub, 2);
+    rc_vector_zeros(&h_sub, 2);
+
+    uniform_real_distribution<double> noise(-1.0, 1.0);
+    rc_vector_t x_last = rc_vector_empty();
+    rc_vector_zeros(&x_last, state_count);
+    for (int step = 0; step < STEP_COUNT; step++)
+    {
+        for (int i = 0; i < sensor_vector.len; i++) sensor_vector.d[i] = (step * 0.1) + noise(re);
+        for (int i = 0; i < state_count; i++) x_last.d[i] = fixed_kf.x_est[i];
+        test_obj->tick(&x_last);
+        ASSERT_TRUE(fixed_kf.predict(test_obj->getF(), test_obj->getXPrediction()));
+        ASSERT_TRUE(fixed_kf.correct(test_obj->getH(), sensor_vector,
+            test_obj->getYPrediction(), rows, 2));
+        for (int a = 0; a < 2; a++)
+        {
+            y_sub.d[a] = sensor_vector.d[rows[a]];
+            h_sub.d[a] = test_obj->getYPrediction().d[rows[a]];
+        }
+        ASSERT_TRUE(subset_kf.update(test_obj->getF(), H_sub, test_obj->getXPrediction(), y_sub, h_sub));
+        for (int i = 0; i < state_count; i++)
+        {
+            EXPECT_NEAR(fixed_kf.x_est[i], subset_kf.x_est[i], STDTOL);
+            for (int j = 0; j < state_count; j++)
+            {
+                EXPECT_NEAR(fixed_kf.P[i][j], subset_kf.P[i][j], STDTOL);
+            }
+        }
+    }
+    rc_vector_free(&x_last);
+    rc_matrix_free(&Q);
+    rc_matrix_free(&R);
+    rc_matrix_free(&Pi);
+    rc_matrix_free(&H_sub);
+    rc_vector_free(&y_sub);
+    rc_vector_free(&h_sub);
+}
+
+// With one input stale, librobotcontrol fed the active rows must match
+// the fixed engine fusing the same rows of the full H
+TEST_F(FixedEKFTestFramework, stale_input_rc_test)
+{
+    const int rows[] = {0, 2, 3};
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta, state_axis_t::v},
+        {0.5, 1.5, 2.5, 3.5});
+    MeasurementSubset subset(sensor_vector.len, state_count);
+    uniform_real_distribution<double> noise(-1.0, 1.0);
+    rc_vector_t x_last = rc_vector_empty();
+    rc_vector_zeros(&x_last, state_count);
+    for (int step = 0; step < STEP_COUNT; step++)
+    {
+        for (int i = 0; i < sensor_vector.len; i++) sensor_vector.d[i] = (step * 0.1) + noise(re);
+        // the stale input holds its last value
+        sensor_vector.d[1] = 0;
+        for (int i = 0; i < state_count; i++) x_last.d[i] = fixed_kf.x_est[i];
+        test_obj->tick(&x_last);
+        ASSERT_TRUE(fixed_kf.predict(test_obj->getF(), test_obj->getXPrediction()));
+        ASSERT_TRUE(fixed_kf.correct(test_obj->getH(), sensor_vector,
+            test_obj->getYPrediction(), rows, 3));
+        subset.select(test_obj->getH(), rc_kf.R, sensor_vector, test_obj->getYPrediction(), rows, 3);
+        rc_matrix_t R_all = rc_kf.R;
+        rc_kf.R = subset.getR();
+        rc_kalman_update_ekf(&rc_kf, test_obj->getF(), subset.getH(),
+            test_obj->getXPrediction(), subset.getY(), subset.getYPrediction());
+        rc_kf.R = R_all;
+        for (int i = 0; i < state_count; i++)
+        {
+            EXPECT_NEAR(fixed_kf.x_est[i], rc_kf.x_est.d[i], STDTOL);
+            for (int j = 0; j < state_count; j++)
+            {
+                EXPECT_NEAR(fixed_kf.P[i][j], rc_kf.P.d[i][j], STDTOL);
+            }
+        }
+        for (int i = 0; i < state_count; i++) rc_kf.x_est.d[i] = fixed_kf.x_est[i];
+    }
+    rc_vector_free(&x_last);
+}
+
+// R follows the noise the inputs actually have, in every update form
+TEST_F(FixedEKFTestFramework, adaptive_noise_test)
+{
+    for (int form = 0; form < 3; form++)
+    {
+        buildFilters({state_axis_t::x, state_axis_t::y}, {1, 1});
+        ASSERT_TRUE(fixed_kf.setSelection(sensor_matrix));
+        fixed_kf.setSequential(form == 1);
+        ASSERT_TRUE(fixed_kf.setFactorized(form == 2));
+        ASSERT_TRUE(fixed_kf.setAdaptive(32, 0.1, 100));
+        EXPECT_TRUE(fixed_kf.isAdaptive());
+        EXPECT_NEAR(runStationary(1, 400), 1, 0.8) << form;
+        // A sensor ten times noisier pushes R up, and it comes back after
+        EXPECT_GT(runStationary(10, 100), 20) << form;
+        EXPECT_LT(runStationary(1, 200), 3) << form;
+        // The configured R again
+        fixed_kf.reset();
+        EXPECT_EQ(fixed_kf.getNoiseScale(0), 1);
+        ASSERT_TRUE(fixed_kf.setAdaptive(0, 1, 1));
+        EXPECT_FALSE(fixed_kf.isAdaptive());
+        EXPECT_EQ(runStationary(10, 100), 1);
+        TearDown();
+        SetUp();
+    }
+}
+
+// The adaptive estimate stays within its bounds, and pinned bounds
+// leave the filter as it would be without it
+TEST_F(FixedEKFTestFramework, adaptive_bounds_test)
+{
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta, state_axis_t::v},
+        {MEAS_NOISE, MEAS_NOISE, MEAS_NOISE, MEAS_NOISE});
+    EXPECT_FALSE(fixed_kf.setAdaptive(adaptive_depth + 1, 1, 10));
+    EXPECT_FALSE(fixed_kf.setAdaptive(8, 2, 1));
+    EXPECT_FALSE(fixed_kf.setAdaptive(8, 0, 1));
+    ASSERT_TRUE(fixed_kf.setAdaptive(8, 0.5, 2));
+    EXPECT_LE(runStationary(10, 100), 2);
+    EXPECT_GE(runStationary(0.01, 100), 0.5);
+    fixed_kf.reset();
+    ASSERT_TRUE(fixed_kf.setAdaptive(8, 1, 1));
+    runComparison();
+}
+
+// Measurements fused again after a rewind are still gated, but leave the
+// noise estimates and the gate's counts as they were
+TEST_F(FixedEKFTestFramework, replay_counts_test)
+{
+    for (int form = 0; form < 3; form++)
+    {
+        buildFilters({state_axis_t::x, state_axis_t::y}, {1, 1});
+        ASSERT_TRUE(fixed_kf.setSelection(sensor_matrix));
+        fixed_kf.setSequential(form == 1);
+        ASSERT_TRUE(fixed_kf.setFactorized(form == 2));
+        ASSERT_TRUE(fixed_kf.setAdaptive(8, 0.1, 100));
+        ASSERT_TRUE(fixed_kf.setGate(16, 10));
+        runStationary(0.5, 300);
+        // The same wild x and noisy y, fused once as a replay and once not
+        FixedEKF<state_count, 16> counted = fixed_kf;
+        const uint64_t rejects = fixed_kf.getRejectCount(0);
+        const double scale = fixed_kf.getNoiseScale(1);
+        rc_vector_t x_last = rc_vector_empty();
+        rc_vector_zeros(&x_last, state_count);
+        for (bool replay : {true, false})
+        {
+            FixedEKF<state_count, 16> &ekf = replay ? fixed_kf : counted;
+            ekf.setReplaying(replay);
+            for (int k = 0; k < 20; k++)
+            {
+                for (int i = 0; i < state_count; i++) x_last.d[i] = ekf.x_est[i];
+                test_obj->tick(&x_last);
+                sensor_vector.d[0] = 60;
+                sensor_vector.d[1] = (k % 2) ? 5 : 15;
+                EXPECT_TRUE(ekf.update(test_obj->getF(), test_obj->getH(),
+                    test_obj->getXPrediction(), sensor_vector, test_obj->getYPrediction()));
+            }
+            ekf.setReplaying(false);
+        }
+        EXPECT_EQ(fixed_kf.getRejectCount(0), rejects) << form;
+        EXPECT_EQ(fixed_kf.getNoiseScale(1), scale) << form;
+        EXPECT_GT(counted.getRejectCount(0), rejects) << form;
+        EXPECT_GT(counted.getNoiseScale(1), 10 * scale) << form;
+        rc_vector_free(&x_last);
+        TearDown();
+        SetUp();
+    }
+}
+
+// One wild fix is dropped by the gate, in every update form, where it
+// would otherwise pull the estimate well off
+TEST_F(FixedEKFTestFramework, gate_outlier_test)
+{
+    for (int form = 0; form < 3; form++)
+    {
+        for (bool gated : {false, true})
+        {
+            buildFilters({state_axis_t::x, state_axis_t::y}, {1, 1});
+            ASSERT_TRUE(fixed_kf.setSelection(sensor_matrix));
+            fixed_kf.setSequential(form == 1);
+            ASSERT_TRUE(fixed_kf.setFactorized(form == 2));
+            ASSERT_TRUE(fixed_kf.setGate(gated ? 16 : 0));
+            runStationary(0.5, 300);
+            EXPECT_NEAR(fixed_kf.x_est[state_axis_t::x], 10, 1) << form;
+            const uint64_t before = fixed_kf.getRejectCount(0);
+            rc_vector_t x_last = rc_vector_empty();
+            rc_vector_zeros(&x_last, state_count);
+            for (int i = 0; i < state_count; i++) x_last.d[i] = fixed_kf.x_est[i];
+            test_obj->tick(&x_last);
+            sensor_vector.d[0] = 60;
+            sensor_vector.d[1] = 10;
+            EXPECT_TRUE(fixed_kf.update(test_obj->getF(), test_obj->getH(),
+                test_obj->getXPrediction(), sensor_vector, test_obj->getYPrediction()));
+            if (gated)
+            {
+                EXPECT_NEAR(fixed_kf.x_est[state_axis_t::x], 10, 1) << form;
+                EXPECT_EQ(fixed_kf.getRejectCount(0), before + 1) << form;
+                EXPECT_EQ(fixed_kf.getRejectCount(1), 0) << form;
+                // A real jump is let back in after the limit
+                for (int k = 0; k < 12; k++) runStationary(0.01, 1);
+                sensor_vector.d[0] = 60;
+                for (int k = 0; k < 12; k++)
+                {
+                    for (int i = 0; i < state_count; i++) x_last.d[i] = fixed_kf.x_est[i];
+                    test_obj->tick(&x_last);
+                    fixed_kf.update(test_obj->getF(), test_obj->getH(),
+                        test_obj->getXPrediction(), sensor_vector, test_obj->getYPrediction());
+                }
+                EXPECT_EQ(fixed_kf.getRejectCount(0), before + 11) << form;
+                EXPECT_GT(fixed_kf.x_est[state_axis_t::x], 12) << form;
+            }
+            else
+            {
+                EXPECT_GT(fixed_kf.x_est[state_axis_t::x], 12) << form;
+                EXPECT_EQ(fixed_kf.getRejectCount(0), 0) << form;
+            }
+            rc_vector_free(&x_last);
+            TearDown();
+            SetUp();
+        }
+    }
+    EXPECT_FALSE(fixed_kf.setGate(-1));
+}
+
+// A joint update with a row gated out is the update of the rows left
+TEST_F(FixedEKFTestFramework, gate_joint_rows_test)
+{
+    FixedEKF<state_count, 16> rows_kf;
+    const int rows[] = {0, 2, 3};
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta, state_axis_t::v},
+        {MEAS_NOISE, MEAS_NOISE, MEAS_NOISE, MEAS_NOISE});
+    runStationary(0.5, 50);
+    rows_kf = fixed_kf;
+    ASSERT_TRUE(fixed_kf.setGate(9, 0));
+    rc_vector_t x_last = rc_vector_empty();
+    rc_vector_zeros(&x_last, state_count);
+    for (int i = 0; i < state_count; i++) x_last.d[i] = fixed_kf.x_est[i];
+    test_obj->tick(&x_last);
+    for (int i = 0; i < sensor_vector.len; i++) sensor_vector.d[i] = test_obj->getYPrediction().d[i] + 0.2;
+    sensor_vector.d[1] = -500;
+    ASSERT_TRUE(fixed_kf.update(test_obj->getF(), test_obj->getH(),
+        test_obj->getXPrediction(), sensor_vector, test_obj->getYPrediction()));
+    ASSERT_TRUE(rows_kf.predict(test_obj->getF(), test_obj->getXPrediction()));
+    ASSERT_TRUE(rows_kf.correct(test_obj->getH(), sensor_vector, test_obj->getYPrediction(), rows, 3));
+    EXPECT_EQ(fixed_kf.getRejectCount(1), 1);
+    for (int i = 0; i < state_count; i++)
+    {
+        EXPECT_NEAR(fixed_kf.x_est[i], rows_kf.x_est[i], STDTOL);
+        for (int j = 0; j < state_count; j++) EXPECT_NEAR(fixed_kf.P[i][j], rows_kf.P[i][j], STDTOL);
+    }
+    rc_vector_free(&x_last);
+}
+
+// A heading fix just past north, against an estimate just short of it,
+// moves the estimate a degree, in every update form. The filter is the
+// same one run on an unwrapped heading a turn lower.
+TEST_F(FixedEKFTestFramework, heading_wrap_test)
+{
+    for (int form = 0; form < 3; form++)
+    {
+        FixedEKF<state_count, 16> plain_kf;
+        buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta}, {1, 1, 1});
+        ASSERT_TRUE(fixed_kf.setSelection(sensor_matrix));
+        fixed_kf.setSequential(form == 1);
+        ASSERT_TRUE(fixed_kf.setFactorized(form == 2));
+        plain_kf = fixed_kf;
+        fixed_kf.setWrapAxes(test_obj->getWrapAxes());
+        double x0[state_count] = {10, 10, 359.5, 1, 0, 0};
+        double P0[state_count * state_count] = {};
+        for (int i = 0; i < state_count; i++) P0[(i * state_count) + i] = 1;
+        fixed_kf.setState(x0, P0);
+        x0[state_axis_t::theta] -= 360;
+        plain_kf.setState(x0, P0);
+        rc_vector_t x_last = rc_vector_empty();
+        rc_vector_t y_plain = rc_vector_empty();
+        rc_vector_zeros(&x_last, state_count);
+        rc_vector_zeros(&y_plain, sensor_vector.len);
+        for (int step = 0; step < 20; step++)
+        {
+            sensor_vector.d[0] = 10;
+            sensor_vector.d[1] = 10;
+            sensor_vector.d[2] = 0.5;
+            for (int a = 0; a < sensor_vector.len; a++) y_plain.d[a] = sensor_vector.d[a];
+            for (int i = 0; i < state_count; i++) x_last.d[i] = fixed_kf.x_est[i];
+            test_obj->tick(&x_last);
+            ASSERT_TRUE(fixed_kf.update(test_obj->getF(), test_obj->getH(),
+                test_obj->getXPrediction(), sensor_vector, test_obj->getYPrediction()));
+            for (int i = 0; i < state_count; i++) x_last.d[i] = plain_kf.x_est[i];
+            test_obj->tick(&x_last);
+            ASSERT_TRUE(plain_kf.update(test_obj->getF(), test_obj->getH(),
+                test_obj->getXPrediction(), y_plain, test_obj->getYPrediction()));
+            const double theta = fixed_kf.x_est[state_axis_t::theta];
+            EXPECT_GE(theta, 0) << form;
+            EXPECT_LT(theta, 360) << form;
+            EXPECT_NEAR(theta, wrapHeading(plain_kf.x_est[state_axis_t::theta]), STDTOL) << form;
+            for (int i = 0; i < state_count; i++)
+            {
+                if (i != state_axis_t::theta)
+                {
+                    EXPECT_NEAR(fixed_kf.x_est[i], plain_kf.x_est[i], STDTOL) << form;
+                }
+                for (int j = 0; j < state_count; j++) EXPECT_NEAR(fixed_kf.P[i][j], plain_kf.P[i][j], STDTOL) << form;
+            }
+        }
+        EXPECT_LT(fabs(headingDifference(fixed_kf.x_est[state_axis_t::theta] - 0.5)), 0.2) << form;
+        rc_vector_free(&x_last);
+        rc_vector_free(&y_plain);
+        TearDown();
+        SetUp();
+    }
+}
+
+// A vehicle turning steadily through north several times, with a
+// compass that reports in [0, 360). The estimate tracks it through every
+// crossing in every update form, and the rc engine, handed y from
+// NavState2D::wrapMeasurement(), stays with the fixed engine.
+TEST_F(FixedEKFTestFramework, heading_turn_test)
+{
+    const double rate = 45;
+    for (int form = 0; form < 3; form++)
+    {
+        buildFilters({state_axis_t::theta, state_axis_t::theta_dot}, {1, 1});
+        ASSERT_TRUE(fixed_kf.setSelection(sensor_matrix));
+        fixed_kf.setSequential(form == 1);
+        ASSERT_TRUE(fixed_kf.setFactorized(form == 2));
+        fixed_kf.setWrapAxes(test_obj->getWrapAxes());
+        normal_distribution<double> noise(0, 0.5);
+        rc_vector_t x_last = rc_vector_empty();
+        rc_vector_t y_wrapped = rc_vector_empty();
+        rc_vector_zeros(&x_last, state_count);
+        rc_vector_zeros(&y_wrapped, sensor_vector.len);
+        double truth = 300;
+        for (int step = 0; step < 300; step++)
+        {
+            truth += rate * STDTS;
+            sensor_vector.d[0] = wrapHeading(truth + noise(re));
+            sensor_vector.d[1] = rate + noise(re);
+            for (int i = 0; i < state_count; i++) x_last.d[i] = fixed_kf.x_est[i];
+            test_obj->tick(&x_last);
+            ASSERT_TRUE(fixed_kf.update(test_obj->getF(), test_obj->getH(),
+                test_obj->getXPrediction(), sensor_vector, test_obj->getYPrediction()));
+            const double theta = fixed_kf.x_est[state_axis_t::theta];
+            EXPECT_GE(theta, 0) << form;
+            EXPECT_LT(theta, 360) << form;
+            if (step > 20)
+            {
+                EXPECT_LT(fabs(headingDifference(theta - truth)), 3) << form << " " << step;
+            }
+            if (form != 0) continue;
+            test_obj->wrapMeasurement(sensor_vector, &y_wrapped);
+            rc_kalman_update_ekf(&rc_kf, test_obj->getF(), test_obj->getH(),
+                test_obj->getXPrediction(), y_wrapped, test_obj->getYPrediction());
+            test_obj->wrapState(&rc_kf.x_est);
+            for (int i = 0; i < state_count; i++) EXPECT_NEAR(rc_kf.x_est.d[i], fixed_kf.x_est[i], STDTOL);
+            for (int i = 0; i < state_count; i++) rc_kf.x_est.d[i] = fixed_kf.x_est[i];
+        }
+        // 300 steps at 4.5 degrees is nearly four turns
+        EXPECT_GT(truth - 300, 3 * 360);
+        rc_vector_free(&x_last);
+        rc_vector_free(&y_wrapped);
+        TearDown();
+        SetUp();
+    }
+}
+
+// Single precision covariance must stay close to the double filter
+TEST_F(FixedEKFTestFramework, float_all_axes_test)
+{
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta,
+        state_axis_t::v, state_axis_t::theta_dot, state_axis_t::v_dot});
+    compareFilter(float_kf, FLOATTOL);
+}
+
+TEST_F(FixedEKFTestFramework, float_sequential_test)
+{
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta,
+        state_axis_t::theta, state_axis_t::theta_dot, state_axis_t::v_dot});
+    ASSERT_TRUE(float_kf.setSelection(sensor_matrix));
+    float_kf.setSequential(true);
+    compareFilter(float_kf, FLOATTOL);
+}
+
+TEST_F(FixedEKFTestFramework, float_factorized_test)
+{
+    buildFilters({state_axis_t::x, state_axis_t::y, state_axis_t::theta,
+        state_axis_t::v, state_axis_t::theta_dot, state_axis_t::v_dot});
+    ASSERT_TRUE(float_kf.setFactorized(true));
+    compareFilter(float_kf, FLOATTOL);
+}
+
+// Each model in the registry gets a filter of its own size, which must
+// match rc_kalman_update_ekf running the same model
+TEST_F(FixedEKFTestFramework, model_registry_test)
+{
+    uniform_real_distribution<double> noise(-1.0, 1.0);
+    for (const char *name : {"CV", "CTRV", "CTRA", "3D"})
+    {
+        MotionModel *model = createMotionModel(name, false);
+        ASSERT_NE(model, nullptr);
+        const int n = model->getStateCount();
+        FixedEKFBase *ekf = newFixedEKF<16, double>(n);
+        ASSERT_NE(ekf, nullptr);
+        EXPECT_EQ(ekf->getStateCount(), n);
+        rc_matrix_t Q = rc_matrix_empty();
+        rc_matrix_t R = rc_matrix_empty();
+        rc_matrix_t Pi = rc_matrix_empty();
+        rc_vector_t x_last = rc_vector_empty();
+        vector<double> P(n * n);
+        // observe every state
+        rc_matrix_identity(&sensor_matrix, n);
+        rc_vector_zeros(&sensor_vector, n);
+        rc_vector_zeros(&x_last, n);
+        rc_matrix_identity(&Q, n);
+        rc_matrix_identity(&R, n);
+        rc_matrix_identity(&Pi, n);
+        rc_matrix_times_scalar(&Q, PROC_NOISE);
+        rc_matrix_times_scalar(&R, MEAS_NOISE);
+        rc_kalman_free(&rc_kf);
+        rc_kalman_alloc_ekf(&rc_kf, Q, R, Pi);
+        ASSERT_TRUE(ekf->init(Q, R, Pi));
+        NavState2D state(sensor_matrix, STDTS, model);
+        for (int step = 0; step < STEP_COUNT; step++)
+        {
+            for (int i = 0; i < n; i++) sensor_vector.d[i] = (step * 0.1) + noise(re);
+            for (int i = 0; i < n; i++) x_last.d[i] = ekf->getEstimate()[i];
+            state.tick(&x_last);
+            rc_kalman_update_ekf(&rc_kf, state.getF(), state.getH(),
+                state.getXPrediction(), sensor_vector, state.getYPrediction());
+            ASSERT_TRUE(ekf->predict(state.getF(), state.getXPrediction()));
+            ASSERT_TRUE(ekf->correct(state.getH(), sensor_vector, state.getYPrediction()));
+            ekf->getCovariance(P.data());
+            for (int i = 0; i < n; i++)
+            {
+                EXPECT_NEAR(ekf->getEstimate()[i], rc_kf.x_est.d[i], STDTOL) << name;
+                for (int j = 0; j < n; j++) EXPECT_NEAR(P[(i * n) + j], rc_kf.P.d[i][j], STDTOL) << name;
+            }
+            for (int i = 0; i < n; i++) rc_kf.x_est.d[i] = ekf->getEstimate()[i];
+        }
+        EXPECT_EQ(ekf->getStep(), rc_kf.step);
+        delete ekf;
+        rc_matrix_free(&Q);
+        rc_matrix_free(&R);
+        rc_matrix_free(&Pi);
+        rc_vector_free(&x_last);
+    }
+}
+
+TEST_F(FixedEKFTestFramework, size_check_test)
+{
+    rc_matrix_t Q = rc_matrix_empty();
+    rc_matrix_t R = rc_matrix_empty();
+    rc_matrix_t Pi = rc_matrix_empty();
+    rc_matrix_identity(&Q, state_count);
+    rc_matrix_identity(&R, 17);
+    rc_matrix_identity(&Pi, state_count);
+    EXPECT_FALSE(fixed_kf.init(Q, R, Pi));
+    rc_matrix_identity(&Q, state_count - 1);
+    rc_matrix_identity(&R, 4);
+    EXPECT_FALSE(fixed_kf.init(Q, R, Pi));
+    rc_matrix_free(&Q);
+    rc_matrix_free(&R);
+    rc_matrix_free(&Pi);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
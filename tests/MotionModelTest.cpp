@@ -0,0 +1,261 @@
+#include "../NavEKF_model.h"
+#include "../NavEKF_angle.h"
+#include "gtest/gtest.h"
+#include <random>
+#include <chrono>
+#include <typeinfo>
+
+#define STDTOL              (1e-9)
+#define FDTOL               (1e-5)
+#define FD_STEP             (1e-6)
+#define TRIAL_COUNT         (1000)
+
+using namespace std;
+
+class MotionModelTestFramework : public ::testing::Test
+{
+    protected:
+    void SetUp ()
+    {
+        re.seed(chrono::system_clock::now().time_since_epoch().count());
+        for (int i = 0; i < state_count; i++)
+        {
+            F_rows[i] = F[i];
+            F_ref_rows[i] = F_ref[i];
+        }
+    }
+
+    void randomState(double *state)
+    {
+        uniform_real_distribution<double> xy(-1000, 1000);
+        uniform_real_distribution<double> heading(0, 360);
+        uniform_real_distribution<double> rate(-40, 40);
+        uniform_real_distribution<double> speed(-5, 5);
+        uniform_real_distribution<double> accel(-2, 2);
+        state[state_axis_t::x] = xy(re);
+        state[state_axis_t::y] = xy(re);
+        state[state_axis_t::theta] = heading(re);
+        state[state_axis_t::v] = speed(re);
+        state[state_axis_t::theta_dot] = rate(re);
+        state[state_axis_t::v_dot] = accel(re);
+    }
+
+    default_random_engine re;
+    double F[state_count][state_count];
+    double F_ref[state_count][state_count];
+    double *F_rows[state_count];
+    double *F_ref_rows[state_count];
+};
+
+TEST(DualTest, arithmetic_test)
+{
+    dual_t<2> a(3);
+    dual_t<2> b(4);
+    a.d[0] = 1;
+    b.d[1] = 1;
+    dual_t<2> r = (a * b) + (a / b) - (2.0 * a) + 1.0;
+    EXPECT_DOUBLE_EQ(r.v, 12 + 0.75 - 6 + 1);
+    EXPECT_DOUBLE_EQ(r.d[0], 4 + 0.25 - 2);         // d/da
+    EXPECT_DOUBLE_EQ(r.d[1], 3 - (3.0 / 16));       // d/db
+    r = sin(a * b);
+    EXPECT_DOUBLE_EQ(r.v, sin(12.0));
+    EXPECT_DOUBLE_EQ(r.d[0], 4 * cos(12.0));
+    r = cos(a) * sqrt(b);
+    EXPECT_DOUBLE_EQ(r.d[0], -sin(3.0) * 2);
+    EXPECT_DOUBLE_EQ(r.d[1], cos(3.0) * 0.25);
+}
+
+// The generated Jacobian must agree with central differences of the model
+TEST_F(MotionModelTestFramework, autodiff_finite_difference_test)
+{
+    NavModel2D model;
+    double state[state_count];
+    double plus[state_count];
+    double minus[state_count];
+    double x_next[state_count];
+    for (int trial = 0; trial < TRIAL_COUNT; trial++)
+    {
+        randomState(state);
+        model.predict(state, 0.1, x_next, F_rows);
+        for (int j = 0; j < state_count; j++)
+        {
+            double saved = state[j];
+            state[j] = saved + FD_STEP;
+            model.predict(state, 0.1, plus, nullptr);
+            state[j] = saved - FD_STEP;
+            model.predict(state, 0.1, minus, nullptr);
+            state[j] = saved;
+            for (int i = 0; i < state_count; i++)
+            {
+                EXPECT_NEAR(F[i][j], (plus[i] - minus[i]) / (2 * FD_STEP), FDTOL);
+            }
+        }
+    }
+}
+
+// The hand-written model must match the generated one, across dt changes
+TEST_F(MotionModelTestFramework, fast_matches_autodiff_test)
+{
+    NavModel2D reference;
+    NavModel2DFast fast;
+    uniform_real_distribution<double> step(0.01, 0.5);
+    double state[state_count];
+    double x_next[state_count];
+    double x_next_ref[state_count];
+    for (int i = 0; i < state_count; i++)
+    {
+        for (int j = 0; j < state_count; j++) F[i][j] = 0;
+    }
+    for (int trial = 0; trial < TRIAL_COUNT; trial++)
+    {
+        randomState(state);
+        double dt = (trial % 10) ? 0.1 : step(re);
+        fast.predict(state, dt, x_next, F_rows);
+        reference.predict(state, dt, x_next_ref, F_ref_rows);
+        for (int i = 0; i < state_count; i++)
+        {
+            EXPECT_NEAR(x_next[i], x_next_ref[i], STDTOL);
+            for (int j = 0; j < state_count; j++) EXPECT_NEAR(F[i][j], F_ref[i][j], STDTOL);
+        }
+    }
+}
+
+TEST(MotionModelRegistryTest, registry_test)
+{
+    const char *names[] = {"CV", "CTRV", "CTRA", "3D"};
+    const int counts[] = {4, 5, 6, 8};
+    for (int m = 0; m < 4; m++)
+    {
+        MotionModel *model = createMotionModel(names[m], false);
+        ASSERT_NE(model, nullptr);
+        EXPECT_EQ(model->getStateCount(), counts[m]);
+        EXPECT_LE(model->getStateCount(), max_state_count);
+        for (int i = 0; i < model->getStateCount(); i++)
+        {
+            EXPECT_EQ(model->findAxis(model->getAxisName(i)), i);
+        }
+        EXPECT_EQ(model->findAxis("X"), 0);
+        EXPECT_EQ(model->findAxis("Y"), 1);
+        EXPECT_EQ(model->findAxis("BOGUS"), -1);
+        delete model;
+    }
+    EXPECT_EQ(createMotionModel("BOGUS", false), nullptr);
+    MotionModel *model = createMotionModel("CTRA", false);
+    EXPECT_NE(dynamic_cast<NavModel2DFast *>(model), nullptr);
+    EXPECT_EQ(model->findAxis("V_DOT"), state_axis_t::v_dot);
+    delete model;
+    model = createMotionModel("3D", false);
+    EXPECT_EQ(model->findAxis("DEPTH"), NavModel3D::depth);
+    EXPECT_EQ(model->findAxis("PITCH"), NavModel3D::pitch);
+    delete model;
+}
+
+// Every model's Jacobian must agree with central differences of the model
+TEST_F(MotionModelTestFramework, registry_finite_difference_test)
+{
+    uniform_real_distribution<double> value(-50, 50);
+    double state[max_state_count];
+    double plus[max_state_count];
+    double minus[max_state_count];
+    double x_next[max_state_count];
+    double F_full[max_state_count][max_state_count];
+    double *F_full_rows[max_state_count];
+    for (int i = 0; i < max_state_count; i++) F_full_rows[i] = F_full[i];
+    for (const char *name : {"CV", "CTRV", "CTRA", "3D"})
+    {
+        MotionModel *model = createMotionModel(name, false);
+        const int n = model->getStateCount();
+        for (int trial = 0; trial < TRIAL_COUNT; trial++)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                state[i] = value(re);
+                for (int j = 0; j < n; j++) F_full[i][j] = 0;
+            }
+            model->predict(state, 0.1, x_next, F_full_rows);
+            for (int j = 0; j < n; j++)
+            {
+                double saved = state[j];
+                state[j] = saved + FD_STEP;
+                model->predict(state, 0.1, plus, nullptr);
+                state[j] = saved - FD_STEP;
+                model->predict(state, 0.1, minus, nullptr);
+                state[j] = saved;
+                for (int i = 0; i < n; i++)
+                {
+                    EXPECT_NEAR(F_full[i][j], (plus[i] - minus[i]) / (2 * FD_STEP), FDTOL) << name;
+                }
+            }
+        }
+        delete model;
+    }
+}
+
+// Pitch splits the distance run between the horizontal and depth
+TEST(MotionModelRegistryTest, depth_pitch_test)
+{
+    NavModel3D model;
+    double state[8] = {0};
+    double x_next[8];
+    state[NavModel3D::v] = 2;
+    state[NavModel3D::pitch] = -30;     // nose down
+    model.predict(state, 1, x_next, nullptr);
+    EXPECT_NEAR(x_next[NavModel3D::x], 2 * cos(30 * deg2rad), STDTOL);
+    EXPECT_NEAR(x_next[NavModel3D::y], 0, STDTOL);
+    EXPECT_NEAR(x_next[NavModel3D::depth], 1, STDTOL);
+    EXPECT_NEAR(x_next[NavModel3D::pitch], -30, STDTOL);
+}
+
+// Only the heading wraps; pitch is held within +/-90 and CV has no heading
+TEST(MotionModelRegistryTest, heading_axis_test)
+{
+    for (const char *name : {"CV", "CTRV", "CTRA", "3D"})
+    {
+        for (bool autodiff : {false, true})
+        {
+            MotionModel *model = createMotionModel(name, autodiff);
+            const int theta = model->findAxis("THETA");
+            for (int i = 0; i < model->getStateCount(); i++)
+            {
+                EXPECT_EQ(model->wrapsAxis(i), (i == theta)) << name << " " << i;
+            }
+            delete model;
+        }
+    }
+    EXPECT_DOUBLE_EQ(wrapHeading(-0.5), 359.5);
+    EXPECT_DOUBLE_EQ(wrapHeading(720.25), 0.25);
+    EXPECT_EQ(wrapHeading(-1e-18), 0);
+    EXPECT_DOUBLE_EQ(headingDifference(358.0), -2);
+    EXPECT_DOUBLE_EQ(headingDifference(-358.0), 2);
+    EXPECT_DOUBLE_EQ(headingDifference(180.0), -180);
+    EXPECT_FLOAT_EQ(headingDifference(359.0f), -1.0f);
+}
+
+// A clone is a separate model of the same kind that predicts the same
+TEST(MotionModelRegistryTest, clone_test)
+{
+    double state[max_state_count] = {1, 2, 30, 4, 5, 6, 7, 8};
+    double expected[max_state_count];
+    double actual[max_state_count];
+    for (const char *name : {"CV", "CTRV", "CTRA", "3D"})
+    {
+        for (bool autodiff : {false, true})
+        {
+            MotionModel *model = createMotionModel(name, autodiff);
+            MotionModel *copy = model->clone();
+            ASSERT_NE(copy, nullptr);
+            EXPECT_NE(copy, model);
+            EXPECT_EQ(typeid(*copy), typeid(*model)) << name;
+            model->predict(state, 0.1, expected, nullptr);
+            copy->predict(state, 0.1, actual, nullptr);
+            for (int i = 0; i < model->getStateCount(); i++) EXPECT_EQ(actual[i], expected[i]) << name;
+            delete copy;
+            delete model;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,416 @@
+#include "../NavEKF.h"
+#include "../NavEKF_fixed.h"
+#include "../NavEKF_increment.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+
+extern "C" {
+    #include "roboticscape.h"
+}
+
+#define STDTS               (0.1)
+#define PROC_NOISE          (0.01)
+#define MEAS_NOISE          (0.5)
+#define MAX_INPUTS          (16)
+#define WARMUP_COUNT        (1000)
+#define ITERATION_COUNT     (20000)
+
+using namespace std;
+
+// Heap allocations since startup. On glibc every malloc, calloc and
+// realloc is counted, including those made inside librobotcontrol and
+// by operator new; elsewhere only operator new is.
+static atomic<uint64_t> alloc_count(0);
+
+#ifdef __GLIBC__
+extern "C" {
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+
+    void *malloc(size_t size)
+    {
+        alloc_count.fetch_add(1, memory_order_relaxed);
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        alloc_count.fetch_add(1, memory_order_relaxed);
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *ptr, size_t size)
+    {
+        alloc_count.fetch_add(1, memory_order_relaxed);
+        return __libc_realloc(ptr, size);
+    }
+}
+#else
+void *operator new(size_t size)
+{
+    alloc_count.fetch_add(1, memory_order_relaxed);
+    void *ptr = malloc(size);
+    if (!ptr) throw bad_alloc();
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+#endif
+
+// Time a callable and print the mean nanoseconds and heap allocations
+// per call as one CSV row
+template <typename FUNC>
+void bench(const string &name, int inputs, FUNC f, int iterations = ITERATION_COUNT)
+{
+    for (int i = 0; i < WARMUP_COUNT; i++) f(i);
+    uint64_t allocs = alloc_count.load();
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) f(i);
+    auto stop = chrono::steady_clock::now();
+    allocs = alloc_count.load() - allocs;
+    cout << name << "," << inputs << ","
+        << (chrono::duration<double, nano>(stop - start).count() / iterations) << ","
+        << ((double)allocs / iterations) << endl;
+}
+
+// Input variable and sensor axis for each of up to MAX_INPUTS inputs
+static string inputName(int i) {return "SENSOR_" + to_string(i);}
+
+// NavEKF with its config read from a mission file and its mail handler
+// exposed, so it can be driven without a MOOSDB
+class BenchNavEKF : public NavEKF
+{
+public:
+    bool configure(const string &mission_file)
+    {
+        m_sAppName = "pNavEKF";
+        m_MissionReader.SetAppName(m_sAppName);
+        if (!m_MissionReader.SetFile(mission_file)) return false;
+        return OnStartUp();
+    }
+    using NavEKF::OnNewMail;
+};
+
+// Measurement update cost against the number of inputs, for the
+// librobotcontrol filter and both FixedEKF update modes
+void benchUpdate(int inputs)
+{
+    rc_matrix_t H = rc_matrix_empty();
+    rc_matrix_t Q = rc_matrix_empty();
+    rc_matrix_t R = rc_matrix_empty();
+    rc_matrix_t Pi = rc_matrix_empty();
+    rc_vector_t y = rc_vector_empty();
+    rc_vector_t x_last = rc_vector_empty();
+    rc_kalman_t rc_kf = rc_kalman_empty();
+    FixedEKF<state_count, MAX_INPUTS> joint_kf;
+    FixedEKF<state_count, MAX_INPUTS> seq_kf;
+    FixedEKF<state_count, MAX_INPUTS> sel_joint_kf;
+    FixedEKF<state_count, MAX_INPUTS> sel_seq_kf;
+    FixedEKF<state_count, MAX_INPUTS> ud_kf;
+    FixedEKF<state_count, MAX_INPUTS> adapt_joint_kf;
+    FixedEKF<state_count, MAX_INPUTS> adapt_seq_kf;
+    FixedEKF<state_count, MAX_INPUTS> gate_joint_kf;
+    FixedEKF<state_count, MAX_INPUTS> gate_seq_kf;
+    FixedEKF<state_count, MAX_INPUTS, float> float_joint_kf;
+    FixedEKF<state_count, MAX_INPUTS, float> float_seq_kf;
+    FixedEKF<state_count, MAX_INPUTS, float> float_ud_kf;
+    default_random_engine re(inputs);
+    uniform_real_distribution<double> noise(-1.0, 1.0);
+
+    rc_matrix_zeros(&H, inputs, state_count);
+    for (int i = 0; i < inputs; i++) H.d[i][i % state_count] = 1;
+    rc_matrix_identity(&Q, state_count);
+    rc_matrix_identity(&R, inputs);
+    rc_matrix_identity(&Pi, state_count);
+    rc_matrix_times_scalar(&Q, PROC_NOISE);
+    rc_matrix_times_scalar(&R, MEAS_NOISE);
+    rc_vector_zeros(&y, inputs);
+    rc_vector_zeros(&x_last, state_count);
+    for (int i = 0; i < inputs; i++) y.d[i] = noise(re);
+    rc_kalman_alloc_ekf(&rc_kf, Q, R, Pi);
+    joint_kf.init(Q, R, Pi);
+    seq_kf.init(Q, R, Pi);
+    seq_kf.setSequential(true);
+    sel_joint_kf.init(Q, R, Pi);
+    sel_joint_kf.setSelection(H);
+    sel_seq_kf.init(Q, R, Pi);
+    sel_seq_kf.setSelection(H);
+    sel_seq_kf.setSequential(true);
+    ud_kf.init(Q, R, Pi);
+    ud_kf.setSelection(H);
+    ud_kf.setFactorized(true);
+    // Same as the selection filters, with R estimated from the innovations
+    adapt_joint_kf.init(Q, R, Pi);
+    adapt_joint_kf.setSelection(H);
+    adapt_joint_kf.setAdaptive(32, 0.1, 100);
+    adapt_seq_kf.init(Q, R, Pi);
+    adapt_seq_kf.setSelection(H);
+    adapt_seq_kf.setSequential(true);
+    adapt_seq_kf.setAdaptive(32, 0.1, 100);
+    // and with every innovation tested against the gate
+    gate_joint_kf.init(Q, R, Pi);
+    gate_joint_kf.setSelection(H);
+    gate_joint_kf.setGate(16, 0);
+    gate_seq_kf.init(Q, R, Pi);
+    gate_seq_kf.setSelection(H);
+    gate_seq_kf.setSequential(true);
+    gate_seq_kf.setGate(16, 0);
+    float_joint_kf.init(Q, R, Pi);
+    float_seq_kf.init(Q, R, Pi);
+    float_seq_kf.setSelection(H);
+    float_seq_kf.setSequential(true);
+    float_ud_kf.init(Q, R, Pi);
+    float_ud_kf.setSelection(H);
+    float_ud_kf.setFactorized(true);
+    NavState2D state(H, STDTS);
+    state.tick(&x_last);
+
+    bench("rc_kalman_update_ekf", inputs, [&](int) {
+        rc_kalman_update_ekf(&rc_kf, state.getF(), state.getH(),
+            state.getXPrediction(), y, state.getYPrediction());
+    });
+    bench("fixed_update_joint", inputs, [&](int) {
+        joint_kf.update(state.getF(), state.getH(), state.getXPrediction(), y, state.getYPrediction());
+    });
+    bench("fixed_update_sequential", inputs, [&](int) {
+        seq_kf.update(state.getF(), state.getH(), state.getXPrediction(), y, state.getYPrediction());
+    });
+    bench("fixed_update_ud", inputs, [&](int) {
+        ud_kf.update(state.getF(), state.getH(), state.getXPrediction(), y, state.getYPrediction());
+    });
+    bench("fixed_correct_joint", inputs, [&](int) {
+        joint_kf.correct(state.getH(), y, state.getYPrediction());
+    });
+    bench("fixed_correct_sequential", inputs, [&](int) {
+        seq_kf.correct(state.getH(), y, state.getYPrediction());
+    });
+    bench("fixed_correct_selection_joint", inputs, [&](int) {
+        sel_joint_kf.correct(state.getH(), y, state.getYPrediction());
+    });
+    bench("fixed_correct_selection_sequential", inputs, [&](int) {
+        sel_seq_kf.correct(state.getH(), y, state.getYPrediction());
+    });
+    bench("fixed_correct_adaptive_joint", inputs, [&](int) {
+        adapt_joint_kf.correct(state.getH(), y, state.getYPrediction());
+    });
+    bench("fixed_correct_adaptive_sequential", inputs, [&](int) {
+        adapt_seq_kf.correct(state.getH(), y, state.getYPrediction());
+    });
+    bench("fixed_correct_gated_joint", inputs, [&](int) {
+        gate_joint_kf.correct(state.getH(), y, state.getYPrediction());
+    });
+    bench("fixed_correct_gated_sequential", inputs, [&](int) {
+        gate_seq_kf.correct(state.getH(), y, state.getYPrediction());
+    });
+    bench("float_update_joint", inputs, [&](int) {
+        float_joint_kf.update(state.getF(), state.getH(), state.getXPrediction(), y, state.getYPrediction());
+    });
+    bench("float_update_sequential", inputs, [&](int) {
+        float_seq_kf.update(state.getF(), state.getH(), state.getXPrediction(), y, state.getYPrediction());
+    });
+    bench("float_update_ud", inputs, [&](int) {
+        float_ud_kf.update(state.getF(), state.getH(), state.getXPrediction(), y, state.getYPrediction());
+    });
+
+    rc_kalman_free(&rc_kf);
+    rc_matrix_free(&H);
+    rc_matrix_free(&Q);
+    rc_matrix_free(&R);
+    rc_matrix_free(&Pi);
+    rc_vector_free(&y);
+    rc_vector_free(&x_last);
+}
+
+// Motion model costs, which don't depend on the number of inputs
+void benchModel()
+{
+    rc_matrix_t H = rc_matrix_empty();
+    rc_vector_t x_last = rc_vector_empty();
+    rc_matrix_identity(&H, state_count);
+    rc_vector_zeros(&x_last, state_count);
+    x_last.d[state_axis_t::theta] = 30;
+    x_last.d[state_axis_t::v] = 2;
+    x_last.d[state_axis_t::theta_dot] = 1;
+    x_last.d[state_axis_t::v_dot] = 0.1;
+    NavState2D state(H, STDTS);
+    NavState2D autodiff_state(H, STDTS, new NavModel2D());
+
+    bench("tick", state_count, [&](int) {
+        state.tick(&x_last);
+    });
+    // alternate step lengths, so the cached dt terms are rebuilt every call
+    bench("tick_variable_dt", state_count, [&](int i) {
+        state.tick(&x_last, (i & 1) ? STDTS : (STDTS * 1.5));
+    });
+    bench("calcF", state_count, [&](int) {
+        state.calcF(&x_last);
+    });
+    // the same model with its Jacobian generated by forward-mode autodiff
+    bench("tick_autodiff", state_count, [&](int) {
+        autodiff_state.tick(&x_last);
+    });
+    bench("calcF_autodiff", state_count, [&](int) {
+        autodiff_state.calcF(&x_last);
+    });
+
+    rc_matrix_free(&H);
+    rc_vector_free(&x_last);
+}
+
+// F*P*F^T + Q through the row kernels in T, without and with intrinsics
+template <typename T>
+void benchPropagate(const string &suffix, const rc_matrix_t &F, const rc_matrix_t &P, const rc_matrix_t &Q)
+{
+    const int NP = simdWidth<T>(state_count);
+    alignas(16) T Fw[state_count][NP] = {};
+    alignas(16) T Pw[state_count][NP] = {};
+    alignas(16) T Qw[state_count][NP] = {};
+    alignas(16) T FP[state_count][NP] = {};
+    alignas(16) T Ft[state_count][NP] = {};
+    alignas(16) T out[state_count][NP] = {};
+    for (int i = 0; i < state_count; i++)
+    {
+        for (int j = 0; j < state_count; j++)
+        {
+            Fw[i][j] = F.d[i][j];
+            Pw[i][j] = P.d[i][j];
+            Qw[i][j] = Q.d[i][j];
+        }
+    }
+    bench("covariance_scalar" + suffix, state_count, [&](int) {
+        propagateCovariance<state_count, NP, T, false>(Fw, Pw, Qw, T(1), FP, Ft, out);
+    });
+    bench("covariance_simd" + suffix, state_count, [&](int) {
+        propagateCovariance<state_count, NP, T, true>(Fw, Pw, Qw, T(1), FP, Ft, out);
+    });
+}
+
+// Covariance prediction alone: librobotcontrol's products on
+// pointer-of-rows matrices, the same sum in padded contiguous rows with
+// and without SIMD, and FixedEKF::predict() as a whole
+void benchCovariance()
+{
+    rc_matrix_t H = rc_matrix_empty();
+    rc_matrix_t Q = rc_matrix_empty();
+    rc_matrix_t P = rc_matrix_empty();
+    rc_matrix_t FP = rc_matrix_empty();
+    rc_matrix_t Ft = rc_matrix_empty();
+    rc_matrix_t out = rc_matrix_empty();
+    rc_vector_t x_last = rc_vector_empty();
+    FixedEKF<state_count, MAX_INPUTS> kf;
+    FixedEKF<state_count, MAX_INPUTS, float> float_kf;
+    rc_matrix_identity(&H, state_count);
+    rc_matrix_identity(&Q, state_count);
+    rc_matrix_times_scalar(&Q, PROC_NOISE);
+    rc_matrix_identity(&P, state_count);
+    for (int i = 1; i < state_count; i++)
+    {
+        P.d[i][i - 1] = 0.1;
+        P.d[i - 1][i] = 0.1;
+    }
+    rc_vector_zeros(&x_last, state_count);
+    x_last.d[state_axis_t::theta] = 30;
+    x_last.d[state_axis_t::v] = 2;
+    x_last.d[state_axis_t::theta_dot] = 1;
+    NavState2D state(H, STDTS);
+    state.tick(&x_last);
+    const rc_matrix_t &F = state.getF();
+    // R is never used by predict()
+    kf.init(Q, Q, P);
+    float_kf.init(Q, Q, P);
+
+    bench("covariance_rc", state_count, [&](int) {
+        rc_matrix_multiply(F, P, &FP);
+        rc_matrix_transpose(F, &Ft);
+        rc_matrix_multiply(FP, Ft, &out);
+        rc_matrix_add_inplace(&out, Q);
+    });
+    benchPropagate<double>("", F, P, Q);
+    benchPropagate<float>("_float", F, P, Q);
+    // reset() each time keeps P from growing without bound
+    bench("fixed_predict", state_count, [&](int) {
+        kf.reset();
+        kf.predict(F, state.getXPrediction());
+    });
+    bench("float_predict", state_count, [&](int) {
+        float_kf.reset();
+        float_kf.predict(F, state.getXPrediction());
+    });
+
+    rc_matrix_free(&H);
+    rc_matrix_free(&Q);
+    rc_matrix_free(&P);
+    rc_matrix_free(&FP);
+    rc_matrix_free(&Ft);
+    rc_matrix_free(&out);
+    rc_vector_free(&x_last);
+}
+
+// Text formatting of the covariance, as published to P_MATRIX_OUT
+void benchPrint(NavEKF &app)
+{
+    rc_matrix_t P = rc_matrix_empty();
+    rc_matrix_identity(&P, state_count);
+    rc_matrix_times_scalar(&P, 0.123456789);
+    bench("printMatrix_rc", 0, [&](int) {
+        app.printMatrix(&P, true, " ");
+    });
+    bench("printMatrix_array", 0, [&](int) {
+        app.printMatrix(P.d[0], state_count, state_count, true, " ");
+    });
+    rc_matrix_free(&P);
+}
+
+// Mail handling with a batch of one message per input, plus one
+// message the app doesn't subscribe to
+void benchMail(int inputs)
+{
+    const string mission_file = "/tmp/pNavEKF_bench_" + to_string(inputs) + ".moos";
+    ofstream mission(mission_file);
+    mission << "ProcessConfig = pNavEKF\n{\n";
+    mission << "    PROCESS_NOISE = " << PROC_NOISE << "\n";
+    mission << "    MEASUREMENT_NOISE = " << MEAS_NOISE << "\n";
+    for (int i = 0; i < inputs; i++)
+    {
+        mission << "    INPUT = " << inputName(i) << "\n";
+        mission << "    INPUT_TYPE = X\n";
+    }
+    mission << "}\n";
+    mission.close();
+
+    BenchNavEKF app;
+    if (!app.configure(mission_file))
+    {
+        cerr << "Could not configure pNavEKF from " << mission_file << endl;
+        return;
+    }
+    MOOSMSG_LIST mail;
+    for (int i = 0; i < inputs; i++) mail.push_back(CMOOSMsg(MOOS_NOTIFY, inputName(i), 1.0 + i, 0));
+    mail.push_back(CMOOSMsg(MOOS_NOTIFY, "APPCAST_REQ", "node=all", 0));
+    bench("OnNewMail", inputs, [&](int) {
+        app.OnNewMail(mail);
+    });
+    if (inputs == 1) benchPrint(app);
+    remove(mission_file.c_str());
+}
+
+// Results go to stdout as CSV, one row per benchmark and input count
+int main(int argc, char **argv)
+{
+    cout << "benchmark,inputs,ns_per_op,allocs_per_op" << endl;
+    benchModel();
+    benchCovariance();
+    for (int inputs = 1; inputs <= MAX_INPUTS; inputs++) benchUpdate(inputs);
+    for (int inputs = 1; inputs <= MAX_INPUTS; inputs *= 2) benchMail(inputs);
+    return 0;
+}
@@ -11,6 +11,7 @@ extern "C" {
 
 #define STDTOL              (0.01)
 #define LINTOL              (0.1)
+#define JACTOL              (1e-9)
 #define STDTS               (0.1)
 #define XY_MIN              (-10000)
 #define XY_MAX              (10000.1)
@@ -27,6 +28,9 @@ extern "C" {
 #define V_DOT_MIN           (-2)
 #define V_DOT_MAX           (2.1)
 #define V_DOT_STEP          (0.5)
+#define DT_MIN              (0.01)
+#define DT_MAX              (0.51)
+#define DT_STEP             (0.05)
 #define DEG2RAD             (M_PI/180)
 
 class TickTestFramework : public ::testing::Test
@@ -38,9 +42,9 @@ class TickTestFramework : public ::testing::Test
         sensor_matrix = rc_matrix_empty();
         input_vector = rc_vector_empty();
         output_vector = rc_vector_empty();
-        rc_matrix_identity(&sensor_matrix, NavState2D::getStateCount());
-        rc_vector_zeros(&input_vector, NavState2D::getStateCount());
-        rc_vector_zeros(&output_vector, NavState2D::getStateCount());
+        rc_matrix_identity(&sensor_matrix, state_count);
+        rc_vector_zeros(&input_vector, state_count);
+        rc_vector_zeros(&output_vector, state_count);
 
         test_obj = new NavState2D(sensor_matrix, STDTS);
     }
@@ -68,8 +72,8 @@ class TickTestFramework : public ::testing::Test
 
     void reset()
     {
-        rc_vector_zeros(&input_vector, NavState2D::getStateCount());
-        rc_vector_zeros(&output_vector, NavState2D::getStateCount());
+        rc_vector_zeros(&input_vector, state_count);
+        rc_vector_zeros(&output_vector, state_count);
         test_obj->reset();
     }
 
@@ -591,8 +595,11 @@ TEST_F(TickTestFramework, theta_v_test)
             EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::theta_dot], 0));
             EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::v], v));
             EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::v_dot], 0));
-            EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::x], (v * STDTS * cos(theta * DEG2RAD)), LINTOL));
-            EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::y], (v * STDTS * sin(theta * DEG2RAD)), LINTOL));
+            // F*x also picks up the heading column, d/dtheta of the step times theta
+            EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::x],
+                (v * STDTS * cos(theta * DEG2RAD)) - (theta * v * STDTS * DEG2RAD * sin(theta * DEG2RAD)), LINTOL));
+            EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::y],
+                (v * STDTS * sin(theta * DEG2RAD)) + (theta * v * STDTS * DEG2RAD * cos(theta * DEG2RAD)), LINTOL));
             EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::theta], theta, LINTOL));
             EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::theta_dot], 0, LINTOL));
             EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::v], v, LINTOL));
@@ -930,8 +937,11 @@ TEST_F(TickTestFramework, x_theta_v_test)
                 EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::theta_dot], 0));
                 EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::v], v));
                 EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::v_dot], 0));
-                EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::x], test_obj->getXPrediction().d[state_axis_t::x], LINTOL));
-                EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::y], test_obj->getXPrediction().d[state_axis_t::y], LINTOL));
+                // F*x also picks up the heading column, d/dtheta of the step times theta
+                EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::x], test_obj->getXPrediction().d[state_axis_t::x] -
+                    (theta * v * STDTS * DEG2RAD * sin(DEG2RAD * theta)), LINTOL));
+                EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::y], test_obj->getXPrediction().d[state_axis_t::y] +
+                    (theta * v * STDTS * DEG2RAD * cos(DEG2RAD * theta)), LINTOL));
                 EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::theta], test_obj->getXPrediction().d[state_axis_t::theta], LINTOL));
                 EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::theta_dot], test_obj->getXPrediction().d[state_axis_t::theta_dot], LINTOL));
                 EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::v], test_obj->getYPrediction().d[state_axis_t::v], LINTOL));
@@ -1030,13 +1040,13 @@ TEST_F(TickTestFramework, x_v_theta_dot_test)
                 EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::y], 0));
                 EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::theta], (theta_dot * STDTS)));
                 EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::theta_dot], theta_dot));
-                EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::v], 0));
+                EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::v], v));
                 EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::v_dot], 0));
                 EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::x], x + (v * STDTS)));
                 EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::y], 0));
                 EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::theta], (theta_dot * STDTS)));
                 EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::theta_dot], theta_dot));
-                EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::v], 0));
+                EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::v], v));
                 EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::v_dot], 0));
                 EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::x], test_obj->getXPrediction().d[state_axis_t::x], LINTOL));
                 EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::y], test_obj->getXPrediction().d[state_axis_t::y], LINTOL));
@@ -1049,30 +1059,30 @@ TEST_F(TickTestFramework, x_v_theta_dot_test)
     }
 }
 
-TEST_F(TickTestFramework, x_theta_v_dot_test)
+TEST_F(TickTestFramework, x_v_v_dot_test)
 {
     for (double x = XY_MIN; x < XY_MAX; x += XY_STEP)
     {
-        for (double theta = THETA_MIN; theta < THETA_MAX; theta += THETA_STEP)
+        for (double v = V_MIN; v < V_MAX; v += V_STEP)
         {
             for (double v_dot = V_DOT_MIN; v_dot < V_DOT_MAX; v_dot += V_DOT_STEP)
             {
                 input_vector.d[state_axis_t::x] = x;
-                input_vector.d[state_axis_t::theta] = theta;
+                input_vector.d[state_axis_t::v] = v;
                 input_vector.d[state_axis_t::v_dot] = v_dot;
                 ASSERT_NO_THROW(test_obj->tick(&input_vector));
                 rc_matrix_times_col_vec(test_obj->getF(), input_vector, &output_vector);
-                EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::x], x + (0.5 * v_dot * STDTS * STDTS * cos(DEG2RAD * theta))));
-                EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::y], (0.5 * v_dot * STDTS * STDTS * sin(DEG2RAD * theta))));
-                EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::theta], theta));
+                EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::x], x + (v * STDTS) + (0.5 * v_dot * STDTS * STDTS)));
+                EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::y], 0));
+                EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::theta], 0));
                 EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::theta_dot], 0));
-                EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::v], v_dot * STDTS));
+                EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::v], v + (v_dot * STDTS)));
                 EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::v_dot], v_dot));
-                EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::x], x + (0.5 * v_dot * STDTS * STDTS * cos(DEG2RAD * theta))));
-                EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::y], (0.5 * v_dot * STDTS * STDTS * sin(DEG2RAD * theta))));
-                EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::theta], theta));
+                EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::x], x + (v * STDTS) + (0.5 * v_dot * STDTS * STDTS)));
+                EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::y], 0));
+                EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::theta], 0));
                 EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::theta_dot], 0));
-                EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::v], v_dot * STDTS));
+                EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::v], v + (v_dot * STDTS)));
                 EXPECT_TRUE(equalWithTol(test_obj->getYPrediction().d[state_axis_t::v_dot], v_dot));
                 EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::x], test_obj->getXPrediction().d[state_axis_t::x], LINTOL));
                 EXPECT_TRUE(equalWithTol(output_vector.d[state_axis_t::y], test_obj->getXPrediction().d[state_axis_t::y], LINTOL));
@@ -1085,6 +1095,125 @@ TEST_F(TickTestFramework, x_theta_v_dot_test)
     }
 }
 
+TEST_F(TickTestFramework, variable_dt_test)
+{
+    for (double dt = DT_MIN; dt < DT_MAX; dt += DT_STEP)
+    {
+        for (double theta = THETA_MIN; theta < THETA_MAX; theta += THETA_STEP)
+        {
+            double v = V_MAX - V_STEP;
+            double v_dot = V_DOT_MAX - V_DOT_STEP;
+            double theta_dot = THETA_DOT_MAX - THETA_DOT_STEP;
+            input_vector.d[state_axis_t::theta] = theta;
+            input_vector.d[state_axis_t::v] = v;
+            input_vector.d[state_axis_t::theta_dot] = theta_dot;
+            input_vector.d[state_axis_t::v_dot] = v_dot;
+            ASSERT_NO_THROW(test_obj->tick(&input_vector, dt));
+            EXPECT_TRUE(equalWithTol(test_obj->getTimeStep(), dt));
+            EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::x], ((v * dt) + (0.5 * v_dot * dt * dt)) * cos(DEG2RAD * theta)));
+            EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::y], ((v * dt) + (0.5 * v_dot * dt * dt)) * sin(DEG2RAD * theta)));
+            EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::theta], theta + (theta_dot * dt)));
+            EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::v], v + (v_dot * dt)));
+            EXPECT_TRUE(equalWithTol(test_obj->getF().d[state_axis_t::theta][state_axis_t::theta_dot], dt));
+            EXPECT_TRUE(equalWithTol(test_obj->getF().d[state_axis_t::v][state_axis_t::v_dot], dt));
+            EXPECT_TRUE(equalWithTol(test_obj->getF().d[state_axis_t::x][state_axis_t::v_dot], 0.5 * dt * dt * cos(DEG2RAD * theta)));
+        }
+    }
+}
+
+TEST_F(TickTestFramework, nominal_dt_restore_test)
+{
+    double v = V_MAX - V_STEP;
+    input_vector.d[state_axis_t::v] = v;
+    ASSERT_NO_THROW(test_obj->tick(&input_vector, DT_MAX));
+    EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::x], v * DT_MAX));
+    ASSERT_NO_THROW(test_obj->tick(&input_vector));
+    EXPECT_TRUE(equalWithTol(test_obj->getTimeStep(), STDTS));
+    EXPECT_TRUE(equalWithTol(test_obj->getNominalTimeStep(), STDTS));
+    EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::x], v * STDTS));
+    ASSERT_NO_THROW(test_obj->tick(&input_vector, 0));
+    EXPECT_TRUE(equalWithTol(test_obj->getXPrediction().d[state_axis_t::x], 0));
+    EXPECT_TRUE(equalWithTol(test_obj->getF().d[state_axis_t::x][state_axis_t::v], 0));
+}
+
+// The hand-written Jacobian, with the heading turning, must match the
+// one generated from the model by autodiff
+TEST_F(TickTestFramework, fast_jacobian_test)
+{
+    NavState2D reference(sensor_matrix, STDTS, new NavModel2D());
+    for (double theta = THETA_MIN; theta < THETA_MAX; theta += THETA_STEP)
+    {
+        for (double theta_dot = THETA_DOT_MIN; theta_dot < THETA_DOT_MAX; theta_dot += THETA_DOT_STEP)
+        {
+            input_vector.d[state_axis_t::theta] = theta;
+            input_vector.d[state_axis_t::v] = V_MAX - V_STEP;
+            input_vector.d[state_axis_t::theta_dot] = theta_dot;
+            input_vector.d[state_axis_t::v_dot] = V_DOT_MAX - V_DOT_STEP;
+            ASSERT_NO_THROW(test_obj->tick(&input_vector));
+            ASSERT_NO_THROW(reference.tick(&input_vector));
+            for (int i = 0; i < state_count; i++)
+            {
+                for (int j = 0; j < state_count; j++)
+                {
+                    EXPECT_NEAR(test_obj->getF().d[i][j], reference.getF().d[i][j], JACTOL) << i << " " << j;
+                }
+            }
+        }
+    }
+}
+
+TEST(SensorPredictionTest, selection_and_dense_test)
+{
+    rc_matrix_t sensor_matrix = rc_matrix_empty();
+    rc_vector_t input_vector = rc_vector_empty();
+    rc_matrix_zeros(&sensor_matrix, 3, state_count);
+    rc_vector_zeros(&input_vector, state_count);
+    sensor_matrix.d[0][state_axis_t::theta] = 1;
+    sensor_matrix.d[1][state_axis_t::v] = 1;
+    sensor_matrix.d[2][state_axis_t::theta] = 1;
+    for (int i = 0; i < state_count; i++) input_vector.d[i] = i + 1;
+    NavState2D selection_obj(sensor_matrix, STDTS);
+    selection_obj.tick(&input_vector);
+    EXPECT_DOUBLE_EQ(selection_obj.getYPrediction().d[0], selection_obj.getXPrediction().d[state_axis_t::theta]);
+    EXPECT_DOUBLE_EQ(selection_obj.getYPrediction().d[1], selection_obj.getXPrediction().d[state_axis_t::v]);
+    EXPECT_DOUBLE_EQ(selection_obj.getYPrediction().d[2], selection_obj.getXPrediction().d[state_axis_t::theta]);
+    // A scaled row is no longer a selection and goes through the dense product
+    sensor_matrix.d[1][state_axis_t::v] = 2;
+    sensor_matrix.d[1][state_axis_t::v_dot] = 1;
+    NavState2D dense_obj(sensor_matrix, STDTS);
+    dense_obj.tick(&input_vector);
+    EXPECT_DOUBLE_EQ(dense_obj.getYPrediction().d[0], dense_obj.getXPrediction().d[state_axis_t::theta]);
+    EXPECT_DOUBLE_EQ(dense_obj.getYPrediction().d[1], (2 * dense_obj.getXPrediction().d[state_axis_t::v]) +
+        dense_obj.getXPrediction().d[state_axis_t::v_dot]);
+    rc_matrix_free(&sensor_matrix);
+    rc_vector_free(&input_vector);
+}
+
+// Inputs listed out of state order, one row each as buildSensorMatrix()
+// lays them out, must each predict their own state
+TEST(SensorPredictionTest, input_order_test)
+{
+    const int types[] = {state_axis_t::v_dot, state_axis_t::x, state_axis_t::theta, state_axis_t::v};
+    rc_matrix_t sensor_matrix = rc_matrix_empty();
+    rc_vector_t input_vector = rc_vector_empty();
+    rc_vector_t dense_y = rc_vector_empty();
+    rc_matrix_zeros(&sensor_matrix, 4, state_count);
+    rc_vector_zeros(&input_vector, state_count);
+    for (int a = 0; a < 4; a++) sensor_matrix.d[a][types[a]] = 1;
+    for (int i = 0; i < state_count; i++) input_vector.d[i] = (i + 1) * 10;
+    NavState2D test_obj(sensor_matrix, STDTS);
+    test_obj.tick(&input_vector);
+    rc_matrix_times_col_vec(sensor_matrix, test_obj.getXPrediction(), &dense_y);
+    for (int a = 0; a < 4; a++)
+    {
+        EXPECT_DOUBLE_EQ(test_obj.getYPrediction().d[a], test_obj.getXPrediction().d[types[a]]);
+        EXPECT_DOUBLE_EQ(test_obj.getYPrediction().d[a], dense_y.d[a]);
+    }
+    rc_matrix_free(&sensor_matrix);
+    rc_vector_free(&input_vector);
+    rc_vector_free(&dense_y);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
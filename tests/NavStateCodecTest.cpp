@@ -0,0 +1,88 @@
+#include "../NavEKF_codec.h"
+#include "gtest/gtest.h"
+
+#define STATE_COUNT         (6)
+
+class NavStateCodecTestFramework : public ::testing::Test
+{
+    protected:
+    void SetUp ()
+    {
+        for (int i = 0; i < STATE_COUNT; i++)
+        {
+            x[i] = 10.0 * i + 0.125;
+            for (int j = 0; j < STATE_COUNT; j++)
+            {
+                P[i][j] = 1.0 / (1 + i + j);
+            }
+        }
+    }
+
+    double x[STATE_COUNT];
+    double P[STATE_COUNT][STATE_COUNT];
+    vector<uint8_t> buf;
+    nav_state_packet_t<STATE_COUNT> packet;
+};
+
+TEST_F(NavStateCodecTestFramework, round_trip_test)
+{
+    size_t len = encodeNavState(buf, 1234.5, 42, x, &P[0][0], STATE_COUNT);
+    // header, six states and the 21 entries of the upper triangle
+    EXPECT_EQ(len, 24 + (6 * 8) + (21 * 8));
+    EXPECT_EQ(len, buf.size());
+    ASSERT_TRUE(decodeNavState(buf.data(), buf.size(), packet));
+    EXPECT_EQ(packet.version, nav_state_version);
+    EXPECT_EQ(packet.step, 42);
+    EXPECT_EQ(packet.time, 1234.5);
+    EXPECT_TRUE(packet.flags & nav_state_flag_t::has_covariance);
+    for (int i = 0; i < STATE_COUNT; i++)
+    {
+        EXPECT_EQ(packet.x[i], x[i]);
+        for (int j = 0; j < STATE_COUNT; j++) EXPECT_EQ(packet.P[i][j], P[i][j]);
+    }
+}
+
+TEST_F(NavStateCodecTestFramework, no_covariance_test)
+{
+    size_t len = encodeNavState(buf, 1.0, 1, x, nullptr, STATE_COUNT);
+    EXPECT_EQ(len, 24 + (6 * 8));
+    ASSERT_TRUE(decodeNavState(buf.data(), buf.size(), packet));
+    EXPECT_FALSE(packet.flags & nav_state_flag_t::has_covariance);
+    for (int i = 0; i < STATE_COUNT; i++)
+    {
+        EXPECT_EQ(packet.x[i], x[i]);
+        for (int j = 0; j < STATE_COUNT; j++) EXPECT_EQ(packet.P[i][j], 0);
+    }
+}
+
+// Encoding the same size of message again must reuse the buffer
+TEST_F(NavStateCodecTestFramework, buffer_reuse_test)
+{
+    encodeNavState(buf, 1.0, 1, x, &P[0][0], STATE_COUNT);
+    const uint8_t *data = buf.data();
+    for (int k = 0; k < 100; k++) encodeNavState(buf, k, k, x, &P[0][0], STATE_COUNT);
+    EXPECT_EQ(data, buf.data());
+}
+
+TEST_F(NavStateCodecTestFramework, reject_test)
+{
+    encodeNavState(buf, 1.0, 1, x, &P[0][0], STATE_COUNT);
+    // truncated
+    EXPECT_FALSE(decodeNavState(buf.data(), buf.size() - 1, packet));
+    EXPECT_FALSE(decodeNavState(buf.data(), 10, packet));
+    // wrong state count
+    nav_state_packet_t<4> small;
+    EXPECT_FALSE(decodeNavState(buf.data(), buf.size(), small));
+    // unknown version
+    buf[4]++;
+    EXPECT_FALSE(decodeNavState(buf.data(), buf.size(), packet));
+    buf[4]--;
+    // bad magic
+    buf[0] = 0;
+    EXPECT_FALSE(decodeNavState(buf.data(), buf.size(), packet));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
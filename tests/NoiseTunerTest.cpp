@@ -0,0 +1,189 @@
+#include "../NavEKF_tune.h"
+#include "gtest/gtest.h"
+#include <random>
+#include <cmath>
+
+extern "C" {
+    #include "roboticscape.h"
+}
+
+#define STDTS               (0.1)
+#define SAMPLE_COUNT        (3000)
+#define POS_NOISE           (0.7)
+
+using namespace std;
+
+// A CTRA vehicle on a circle, observed in x and y with known noise
+class NoiseTunerTestFramework : public ::testing::Test
+{
+    protected:
+    void SetUp ()
+    {
+        H = rc_matrix_empty();
+        rc_matrix_zeros(&H, 2, state_count);
+        H.d[0][state_axis_t::x] = 1;
+        H.d[1][state_axis_t::y] = 1;
+    }
+
+    void TearDown()
+    {
+        rc_matrix_free(&H);
+    }
+
+    void loadCircle(NoiseTuner &tuner, bool with_reference)
+    {
+        default_random_engine re(7);
+        normal_distribution<double> noise(0, POS_NOISE);
+        for (int k = 0; k < SAMPLE_COUNT; k++)
+        {
+            const double t = k * STDTS;
+            const double x = 50 * sin(0.05 * t);
+            const double y = 50 * cos(0.05 * t);
+            tuner.addSample(t, 0, x + noise(re));
+            tuner.addSample(t + 0.01, 1, y + noise(re));
+            if (with_reference && ((k % 10) == 5))
+            {
+                tuner.addReference(t, state_axis_t::x, x);
+                tuner.addReference(t, state_axis_t::y, y);
+            }
+        }
+    }
+
+    rc_matrix_t H;
+};
+
+TEST_F(NoiseTunerTestFramework, init_test)
+{
+    NoiseTuner tuner;
+    EXPECT_FALSE(tuner.init("NOPE", false, H, STDTS, false));
+    EXPECT_FALSE(tuner.init("CV", false, H, STDTS, false));
+    EXPECT_FALSE(tuner.init("CTRA", false, H, 0, false));
+    ASSERT_TRUE(tuner.init("CTRA", false, H, STDTS, false));
+    EXPECT_EQ(tuner.getStateCount(), state_count);
+}
+
+TEST_F(NoiseTunerTestFramework, log_space_test)
+{
+    vector<double> values = NoiseTuner::logSpace(0.01, 100, 5);
+    ASSERT_EQ(values.size(), 5);
+    const double expected[] = {0.01, 0.1, 1, 10, 100};
+    for (int i = 0; i < 5; i++) EXPECT_NEAR(values[i], expected[i], 1e-12 * expected[i]);
+    values = NoiseTuner::logSpace(0.1, 10, 1);
+    ASSERT_EQ(values.size(), 1);
+    EXPECT_NEAR(values[0], 1, 1e-12);
+}
+
+// With the true measurement variance, the NIS is close to 1, and much
+// larger or smaller R push it away on either side
+TEST_F(NoiseTunerTestFramework, nis_test)
+{
+    for (bool event : {false, true})
+    {
+        NoiseTuner tuner;
+        ASSERT_TRUE(tuner.init("CTRA", false, H, STDTS, event));
+        loadCircle(tuner, false);
+        EXPECT_EQ(tuner.getSampleCount(), 2 * SAMPLE_COUNT);
+        const double r_true = POS_NOISE * POS_NOISE;
+        tune_result_t good = tuner.evaluate(0.01, r_true);
+        tune_result_t low = tuner.evaluate(0.01, r_true / 100);
+        tune_result_t high = tuner.evaluate(0.01, r_true * 100);
+        EXPECT_EQ(good.failures, 0);
+        EXPECT_GT(good.updates, 0);
+        EXPECT_NEAR(good.nis, 1, 0.5) << event;
+        EXPECT_GT(low.nis, 2 * good.nis);
+        EXPECT_LT(high.nis, 0.5 * good.nis);
+        EXPECT_LT(good.score, low.score);
+        EXPECT_LT(good.score, high.score);
+    }
+}
+
+// Weights scale the diagonals of Q and R under each setting
+TEST_F(NoiseTunerTestFramework, noise_weights_test)
+{
+    NoiseTuner tuner;
+    ASSERT_TRUE(tuner.init("CTRA", false, H, STDTS, false));
+    loadCircle(tuner, false);
+    const double r_true = POS_NOISE * POS_NOISE;
+    tune_result_t plain = tuner.evaluate(0.02, 2 * r_true);
+    EXPECT_FALSE(tuner.setNoiseWeights(vector<double>(state_count, 2), vector<double>(3, 2)));
+    EXPECT_FALSE(tuner.setNoiseWeights(vector<double>(4, 2), vector<double>(2, 2)));
+    ASSERT_TRUE(tuner.setNoiseWeights(vector<double>(state_count, 2), vector<double>(2, 2)));
+    tune_result_t weighted = tuner.evaluate(0.01, r_true);
+    EXPECT_DOUBLE_EQ(weighted.nis, plain.nis);
+    EXPECT_DOUBLE_EQ(weighted.score, plain.score);
+    // Down-weighting one input moves the NIS off
+    ASSERT_TRUE(tuner.setNoiseWeights(vector<double>(state_count, 1), {1, 0.01}));
+    EXPECT_GT(tuner.evaluate(0.01, r_true).nis, 2 * plain.nis);
+}
+
+// In tick mode an input that has gone quiet stops being fused once its
+// timeout passes, rather than holding its last value, and a tick with
+// nothing fresh is skipped
+TEST_F(NoiseTunerTestFramework, timeout_test)
+{
+    NoiseTuner tuner;
+    ASSERT_TRUE(tuner.init("CTRA", false, H, STDTS, false));
+    EXPECT_FALSE(tuner.setTimeouts({0.5}));
+    default_random_engine re(7);
+    normal_distribution<double> noise(0, POS_NOISE);
+    for (int k = 0; k < SAMPLE_COUNT; k++)
+    {
+        const double t = k * STDTS;
+        const double x = 50 * sin(0.05 * t);
+        const double y = 50 * cos(0.05 * t);
+        // y drops out for 30 s, and everything for 5 s
+        if ((t >= 200) && (t < 205)) continue;
+        tuner.addSample(t, 0, x + noise(re));
+        if ((t < 100) || (t >= 130)) tuner.addSample(t + 0.01, 1, y + noise(re));
+        if ((k % 10) == 5)
+        {
+            tuner.addReference(t, state_axis_t::x, x);
+            tuner.addReference(t, state_axis_t::y, y);
+        }
+    }
+    tuner.setScore(score_error);
+    const double r_true = POS_NOISE * POS_NOISE;
+    tune_result_t held = tuner.evaluate(0.01, r_true);
+    ASSERT_TRUE(tuner.setTimeouts({0.5, 0.5}));
+    tune_result_t timed = tuner.evaluate(0.01, r_true);
+    EXPECT_LT(timed.rms_error, held.rms_error);
+    EXPECT_LT(timed.updates + 40, held.updates);
+    EXPECT_EQ(timed.failures, 0);
+}
+
+// The sweep gives the same answers whatever the number of threads
+TEST_F(NoiseTunerTestFramework, sweep_test)
+{
+    NoiseTuner tuner;
+    ASSERT_TRUE(tuner.init("CTRA", false, H, STDTS, true));
+    loadCircle(tuner, true);
+    tuner.setScore(score_error);
+    vector<pair<double, double>> settings;
+    for (double q : NoiseTuner::logSpace(1e-4, 1, 5))
+    {
+        for (double r : NoiseTuner::logSpace(1e-2, 100, 5)) settings.push_back(make_pair(q, r));
+    }
+    vector<tune_result_t> serial = tuner.sweep(settings, 1);
+    vector<tune_result_t> threaded = tuner.sweep(settings, 4);
+    ASSERT_EQ(serial.size(), settings.size());
+    ASSERT_EQ(threaded.size(), settings.size());
+    for (int c = 0; c < (int)settings.size(); c++)
+    {
+        EXPECT_EQ(threaded[c].proc_noise, settings[c].first);
+        EXPECT_EQ(threaded[c].meas_noise, settings[c].second);
+        EXPECT_DOUBLE_EQ(serial[c].score, threaded[c].score);
+        EXPECT_DOUBLE_EQ(serial[c].nis, threaded[c].nis);
+        EXPECT_GT(serial[c].rms_error, 0);
+    }
+    int best = NoiseTuner::best(serial);
+    ASSERT_GE(best, 0);
+    for (auto &res : serial) EXPECT_LE(serial[best].score, res.score);
+    // filtering should beat the raw measurements
+    EXPECT_LT(serial[best].rms_error, POS_NOISE);
+    EXPECT_EQ(NoiseTuner::best(vector<tune_result_t>()), -1);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,147 @@
+#include "../NavEKF_buffer.h"
+#include "gtest/gtest.h"
+#include <thread>
+
+#define RING_DEPTH          (8)
+#define HISTORY_DEPTH       (4)
+#define PRODUCER_COUNT      (100000)
+
+TEST(SampleRingTest, fill_drain_test)
+{
+    SampleRing<sensor_sample_t, RING_DEPTH> ring;
+    sensor_sample_t sample;
+    EXPECT_TRUE(ring.empty());
+    EXPECT_FALSE(ring.pop(sample));
+    for (int i = 0; i < (RING_DEPTH - 1); i++)
+    {
+        EXPECT_TRUE(ring.push({i * 0.1, i * 1.0, i}));
+    }
+    EXPECT_FALSE(ring.push({1.0, 1.0, 1}));
+    for (int i = 0; i < (RING_DEPTH - 1); i++)
+    {
+        ASSERT_TRUE(ring.pop(sample));
+        EXPECT_EQ(sample.slot, i);
+        EXPECT_DOUBLE_EQ(sample.value, i * 1.0);
+    }
+    EXPECT_TRUE(ring.empty());
+}
+
+TEST(SampleRingTest, wrap_test)
+{
+    SampleRing<sensor_sample_t, RING_DEPTH> ring;
+    sensor_sample_t sample;
+    for (int i = 0; i < (RING_DEPTH * 5); i++)
+    {
+        ASSERT_TRUE(ring.push({i * 0.1, i * 1.0, i}));
+        ASSERT_TRUE(ring.push({i * 0.1, i * 2.0, i}));
+        ASSERT_TRUE(ring.pop(sample));
+        ASSERT_TRUE(ring.pop(sample));
+        EXPECT_DOUBLE_EQ(sample.value, i * 2.0);
+    }
+    EXPECT_TRUE(ring.empty());
+}
+
+TEST(SampleRingTest, threaded_order_test)
+{
+    SampleRing<sensor_sample_t, RING_DEPTH> ring;
+    thread producer([&ring]() {
+        for (int i = 0; i < PRODUCER_COUNT; i++)
+        {
+            while (!ring.push({i * 1.0, i * 1.0, i})) this_thread::yield();
+        }
+    });
+    sensor_sample_t sample;
+    int expected = 0;
+    while (expected < PRODUCER_COUNT)
+    {
+        if (ring.pop(sample))
+        {
+            ASSERT_EQ(sample.slot, expected);
+            expected++;
+        }
+        // let the producer run on a single core
+        else this_thread::yield();
+    }
+    producer.join();
+    EXPECT_TRUE(ring.empty());
+}
+
+TEST(FilterHistoryTest, find_truncate_test)
+{
+    FilterHistory<2, HISTORY_DEPTH> history;
+    EXPECT_EQ(history.findBefore(1.0), -1);
+    for (int i = 0; i < 3; i++)
+    {
+        history.push().sample = {i * 1.0, 0.0, 0};
+    }
+    EXPECT_EQ(history.size(), 3);
+    EXPECT_EQ(history.findBefore(-0.5), -1);
+    EXPECT_EQ(history.findBefore(0.0), 0);
+    EXPECT_EQ(history.findBefore(1.5), 1);
+    EXPECT_EQ(history.findBefore(10.0), 2);
+    history.truncate(2);
+    EXPECT_EQ(history.size(), 2);
+    EXPECT_EQ(history.findBefore(10.0), 1);
+}
+
+TEST(FilterHistoryTest, overwrite_oldest_test)
+{
+    FilterHistory<2, HISTORY_DEPTH> history;
+    for (int i = 0; i < (HISTORY_DEPTH + 2); i++)
+    {
+        history.push().sample = {i * 1.0, 0.0, i};
+    }
+    EXPECT_EQ(history.size(), HISTORY_DEPTH);
+    EXPECT_EQ(history.at(0).sample.slot, 2);
+    EXPECT_EQ(history.at(HISTORY_DEPTH - 1).sample.slot, HISTORY_DEPTH + 1);
+    EXPECT_EQ(history.findBefore(1.0), -1);
+    EXPECT_EQ(history.findBefore(2.5), 0);
+}
+
+TEST(TripleBufferTest, latest_value_test)
+{
+    TripleBuffer<int> buffer;
+    EXPECT_FALSE(buffer.update());
+    buffer.back() = 1;
+    buffer.publish();
+    buffer.back() = 2;
+    buffer.publish();
+    ASSERT_TRUE(buffer.update());
+    EXPECT_EQ(buffer.front(), 2);
+    EXPECT_FALSE(buffer.update());
+    EXPECT_EQ(buffer.front(), 2);
+    buffer.back() = 3;
+    buffer.publish();
+    ASSERT_TRUE(buffer.update());
+    EXPECT_EQ(buffer.front(), 3);
+}
+
+// The consumer must never see a torn value or go backwards
+TEST(TripleBufferTest, threaded_consistency_test)
+{
+    struct pair_t {int a; int b;};
+    TripleBuffer<pair_t> buffer;
+    thread producer([&buffer]() {
+        for (int i = 1; i <= PRODUCER_COUNT; i++)
+        {
+            buffer.back().a = i;
+            buffer.back().b = -i;
+            buffer.publish();
+        }
+    });
+    int last = 0;
+    while (last < PRODUCER_COUNT)
+    {
+        if (!buffer.update()) continue;
+        const pair_t &value = buffer.front();
+        ASSERT_EQ(value.a, -value.b);
+        ASSERT_GT(value.a, last);
+        last = value.a;
+    }
+    producer.join();
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
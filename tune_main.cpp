@@ -0,0 +1,210 @@
+/************************************************************/
+/*    NAME: Pierce Nichols                                    */
+/*    ORGN: Ladon Robotics                                             */
+/*    FILE: tune_main.cpp                                        */
+/*    DATE:                                                 */
+/************************************************************/
+
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include "MBUtils.h"
+#include "NavEKF_replay.h"
+
+using namespace std;
+
+void showTuneHelpAndExit()
+{
+  cout << "Usage: pNavEKF_Tune file.moos file.alog [OPTIONS]" << endl;
+  cout << endl;
+  cout << "Replays the INPUT variables of file.alog through the pNavEKF filter of" << endl;
+  cout << "file.moos for a grid of PROCESS_NOISE and MEASUREMENT_NOISE values, in" << endl;
+  cout << "parallel, and reports the best. Every setting tried is written to stdout" << endl;
+  cout << "as CSV; the best goes to stderr. <AXIS>_PROCESS_NOISE and INPUT_NOISE keep" << endl;
+  cout << "their ratios to the two swept." << endl;
+  cout << endl;
+  cout << "Options:" << endl;
+  cout << "  --alias=<ProcessName>    Read this block of file.moos rather than pNavEKF" << endl;
+  cout << "  --process=<lo>:<hi>[:n]  PROCESS_NOISE values, n of them spaced evenly in log" << endl;
+  cout << "                           (default 1/100 to 100 times the configured value, n=9)" << endl;
+  cout << "  --measurement=<lo>:<hi>[:n]  The same for MEASUREMENT_NOISE" << endl;
+  cout << "  --refine=<rounds>        Grids to run, each narrowed around the last best (default 3)" << endl;
+  cout << "  --reference=<var>:<axis> A logged variable holding the true value of an axis," << endl;
+  cout << "                           e.g. GT_X:X. May be repeated." << endl;
+  cout << "  --score=nis|error        Score on innovation consistency, or on RMS error" << endl;
+  cout << "                           against the references (the default when given)" << endl;
+  cout << "  --threads=<n>            Threads to use (default one per core)" << endl;
+  cout << "  --help, -h               Display this help message" << endl;
+  exit(0);
+}
+
+// <lo>:<hi>[:n]
+bool parseRange(string text, double &lo, double &hi, int &count)
+{
+  vector<string> parts = parseString(text, ':');
+  if((parts.size() < 2) || (parts.size() > 3))
+    return(false);
+  lo = atof(parts[0].c_str());
+  hi = atof(parts[1].c_str());
+  if(parts.size() == 3)
+    count = atoi(parts[2].c_str());
+  return((lo > 0) && (hi >= lo) && (count > 0));
+}
+
+int main(int argc, char *argv[])
+{
+  string mission_file;
+  string alog_file;
+  string app_name = "pNavEKF";
+  string q_range;
+  string r_range;
+  string score_name;
+  int rounds = 3;
+  int threads = 0;
+  vector<pair<string, string>> references;
+
+  for(int i=1; i<argc; i++) {
+    string argi = argv[i];
+    if((argi == "-h") || (argi == "--help") || (argi=="-help"))
+      showTuneHelpAndExit();
+    else if(strEnds(argi, ".moos") || strEnds(argi, ".moos++"))
+      mission_file = argi;
+    else if(strEnds(argi, ".alog"))
+      alog_file = argi;
+    else if(strBegins(argi, "--alias="))
+      app_name = argi.substr(8);
+    else if(strBegins(argi, "--process="))
+      q_range = argi.substr(10);
+    else if(strBegins(argi, "--measurement="))
+      r_range = argi.substr(14);
+    else if(strBegins(argi, "--refine="))
+      rounds = atoi(argi.substr(9).c_str());
+    else if(strBegins(argi, "--threads="))
+      threads = atoi(argi.substr(10).c_str());
+    else if(strBegins(argi, "--score="))
+      score_name = argi.substr(8);
+    else if(strBegins(argi, "--reference=") && (argi.find(':') != string::npos)) {
+      string ref = argi.substr(12);
+      string var = biteString(ref, ':');
+      references.push_back(make_pair(var, ref));
+    }
+    else {
+      cerr << "Unknown option: " << argi << endl;
+      return(1);
+    }
+  }
+
+  if((mission_file == "") || (alog_file == ""))
+    showTuneHelpAndExit();
+  if(threads <= 0)
+    threads = max<int>(thread::hardware_concurrency(), 1);
+  rounds = max(rounds, 1);
+
+  NavReplay replay;
+  bool configured = replay.configure(mission_file, app_name);
+  for(auto &warning : replay.getConfigWarnings())
+    cerr << "Config warning: " << warning << endl;
+  if(!configured) {
+    cerr << "Could not configure " << app_name << " from " << mission_file << endl;
+    return(1);
+  }
+
+  // The default ranges are centred on the mission's settings, which have
+  // to be positive to be centred on
+  double q_base = replay.getProcessNoise();
+  double r_base = replay.getMeasurementNoise();
+  if(!(q_base > 0)) {
+    cerr << "PROCESS_NOISE is not positive; tuning around 1, with every axis weighted the same" << endl;
+    q_base = 1;
+  }
+  if(!(r_base > 0)) {
+    cerr << "MEASUREMENT_NOISE is not positive; tuning around 1, with every input weighted the same" << endl;
+    r_base = 1;
+  }
+  double q_lo = q_base / 100;
+  double q_hi = q_base * 100;
+  double r_lo = r_base / 100;
+  double r_hi = r_base * 100;
+  int q_count = 9;
+  int r_count = 9;
+  if(((q_range != "") && !parseRange(q_range, q_lo, q_hi, q_count)) ||
+     ((r_range != "") && !parseRange(r_range, r_lo, r_hi, r_count))) {
+    cerr << "Ranges are <lo>:<hi>[:n], with 0 < lo <= hi" << endl;
+    return(1);
+  }
+
+  ifstream alog(alog_file);
+  if(!alog) {
+    cerr << "Could not open " << alog_file << endl;
+    return(1);
+  }
+  NoiseTuner tuner;
+  if(!replay.loadTuner(alog, tuner, references)) {
+    cerr << "Could not set up the tuner; check the reference axis names" << endl;
+    return(1);
+  }
+  if((score_name == "error") || ((score_name == "") && !references.empty()))
+    tuner.setScore(score_error);
+  else if((score_name == "") || (score_name == "nis"))
+    tuner.setScore(score_nis);
+  else {
+    cerr << "Unknown score: " << score_name << endl;
+    return(1);
+  }
+  cerr << tuner.getSampleCount() << " input samples, " << tuner.getReferenceCount()
+       << " reference samples" << endl;
+
+  auto start = chrono::steady_clock::now();
+  cout << "proc_noise,meas_noise,nis,rms_error,score,updates,failures" << endl;
+  tune_result_t best = {0, 0, 0, 0, INFINITY, 0, 0};
+  int evaluated = 0;
+  for(int round = 0; round < rounds; round++) {
+    vector<pair<double, double>> settings;
+    for(double q : NoiseTuner::logSpace(q_lo, q_hi, q_count)) {
+      for(double r : NoiseTuner::logSpace(r_lo, r_hi, r_count))
+        settings.push_back(make_pair(q, r));
+    }
+    vector<tune_result_t> results = tuner.sweep(settings, threads);
+    for(auto &res : results) {
+      cout << res.proc_noise << "," << res.meas_noise << "," << res.nis << ","
+           << res.rms_error << "," << res.score << "," << res.updates << ","
+           << res.failures << endl;
+    }
+    evaluated += results.size();
+    int index = NoiseTuner::best(results);
+    if(results[index].score < best.score)
+      best = results[index];
+    // With nothing scored there is no best to narrow around, and the
+    // same grid would only score the same again
+    if(!isfinite(best.score))
+      break;
+    // Narrow each range to one step either side of the best so far
+    if(q_count > 1) {
+      double q_step = pow(q_hi / q_lo, 1.0 / (q_count - 1));
+      q_lo = best.proc_noise / q_step;
+      q_hi = best.proc_noise * q_step;
+    }
+    if(r_count > 1) {
+      double r_step = pow(r_hi / r_lo, 1.0 / (r_count - 1));
+      r_lo = best.meas_noise / r_step;
+      r_hi = best.meas_noise * r_step;
+    }
+  }
+  double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  cerr << evaluated << " settings in " << wall << " s on " << threads << " threads" << endl;
+  if(!isfinite(best.score)) {
+    cerr << "No setting could be scored" << endl;
+    return(1);
+  }
+  cerr << "Best: mean NIS " << best.nis;
+  if(tuner.getReferenceCount() > 0)
+    cerr << ", RMS error " << best.rms_error;
+  cerr << endl;
+  cerr << "  PROCESS_NOISE = " << best.proc_noise << endl;
+  cerr << "  MEASUREMENT_NOISE = " << best.meas_noise << endl;
+  return(0);
+}